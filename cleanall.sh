@@ -1,6 +1,8 @@
 #!/usr/bin/env bash
 
-cd code/held_karp
+cd code/parse
+make clean
+cd ../held_karp
 make clean
 cd ../top_hk
 make clean
@@ -8,5 +10,17 @@ cd ../lin_kern
 make clean
 cd ../genetic
 make clean
+cd ../branch_bound
+make clean
+cd ../annealing
+make clean
+cd ../cluster
+make clean
+cd ../aco
+make clean
+cd ../libtsp
+make clean
+cd ../bench
+make clean
 
 cd ../..
@@ -0,0 +1,467 @@
+/*  MAX-MIN ant system for the symmetric TSP
+    Input: any symmetric instance the parser reads.
+    Output: The best tour found.
+    Pheromone is only kept on the edges from every city to its CANDIDATES
+    nearest neighbours, as an n x k array laid out like the candidate lists.
+    Every iteration first turns it into choice weights tau * eta^BETA, eta the
+    inverse distance, in one vectorized pass, then the ants build their tours
+    in parallel, each in buffers its thread allocated once: at every step the
+    weights of the candidates still open are gathered, masked and summed in
+    SIMD and one uniform draw picks among them. An ant whose candidates are
+    all visited moves to the nearest open city. The iteration's best ant is
+    found by a reduction over the ants (the lowest index wins a tie, so the
+    tour does not depend on the thread count), and only it, or the best tour
+    so far every GLOBAL_EVERY iterations, deposits pheromone: O(n) entries
+    written by one thread, so the update needs no atomics. Evaporation is
+    another vectorized pass over the n x k array, and the trails are kept
+    within [tau_min, tau_max] from the best tour as in Stuetzle and Hoos. When
+    the best tour has not improved for STAGNATION iterations the trails are
+    reset. The colony's best tour is finally polished by Lin-Kernighan
+    starting from it.
+*/
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "../common/rng.h"
+#include "../libtsp/tsp.h"
+#include "../common/perf.h"
+
+using namespace std;
+
+namespace aco {
+
+const int CANDIDATES = 16;
+const int MIN_ANTS = 16;
+const int ITERATIONS = 500;
+// Fraction of the pheromone that evaporates every iteration
+const double RHO = 0.1;
+// Weight of the distance against the pheromone in the choice weights
+const double BETA = 4;
+// Chance that a converged colony still builds the best tour, sets tau_min
+const double PBEST = 0.05;
+const int GLOBAL_EVERY = 5;
+const int STAGNATION = 150;
+
+
+namespace kernels {
+
+const int LANES = 8;
+
+// Sums the lanes in a fixed order so every kernel gets the same float total
+inline float lane_total(const float *lanes) {
+    float total = 0;
+    for (int l = 0; l < LANES; l++) {
+        total += lanes[l];
+    }
+    return total;
+}
+
+inline void product_scalar(const float *a, const float *b, float *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = a[i] * b[i];
+    }
+}
+
+inline void evaporate_scalar(float *tau, size_t count, float keep, float low) {
+    for (size_t i = 0; i < count; i++) {
+        tau[i] = max(tau[i] * keep, low);
+    }
+}
+
+inline float open_weights_scalar(const float *choice, const int *cand, const float *open, int k, float *out) {
+    float lanes[LANES] = {0};
+    int c = 0;
+    for (; c + LANES <= k; c += LANES) {
+        for (int l = 0; l < LANES; l++) {
+            out[c + l] = choice[c + l] * open[cand[c + l]];
+            lanes[l] += out[c + l];
+        }
+    }
+    float total = lane_total(lanes);
+    for (; c < k; c++) {
+        out[c] = choice[c] * open[cand[c]];
+        total += out[c];
+    }
+    return total;
+}
+
+#ifdef SIMD_DIST_X86
+
+__attribute__((target("avx2")))
+inline void product_avx2(const float *a, const float *b, float *out, size_t count) {
+    size_t i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    product_scalar(a + i, b + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+inline void evaporate_avx2(float *tau, size_t count, float keep, float low) {
+    __m256 vk = _mm256_set1_ps(keep), vl = _mm256_set1_ps(low);
+    size_t i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        _mm256_storeu_ps(tau + i, _mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(tau + i), vk), vl));
+    }
+    evaporate_scalar(tau + i, count - i, keep, low);
+}
+
+__attribute__((target("avx2")))
+inline float open_weights_avx2(const float *choice, const int *cand, const float *open, int k, float *out) {
+    __m256 sum = _mm256_setzero_ps();
+    int c = 0;
+    for (; c + LANES <= k; c += LANES) {
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(cand + c));
+        __m256 w = _mm256_mul_ps(_mm256_loadu_ps(choice + c), _mm256_i32gather_ps(open, idx, 4));
+        _mm256_storeu_ps(out + c, w);
+        sum = _mm256_add_ps(sum, w);
+    }
+    float lanes[LANES];
+    _mm256_storeu_ps(lanes, sum);
+    float total = lane_total(lanes);
+    for (; c < k; c++) {
+        out[c] = choice[c] * open[cand[c]];
+        total += out[c];
+    }
+    return total;
+}
+
+#endif
+
+}
+
+
+// out[i] = a[i] * b[i]
+inline void product(const float *a, const float *b, float *out, size_t count) {
+#ifdef SIMD_DIST_X86
+    if (simd_support() != SIMD_SCALAR) {
+        kernels::product_avx2(a, b, out, count);
+        return;
+    }
+#endif
+    kernels::product_scalar(a, b, out, count);
+}
+
+// tau[i] = max(tau[i] * keep, low)
+inline void evaporate(float *tau, size_t count, float keep, float low) {
+#ifdef SIMD_DIST_X86
+    if (simd_support() != SIMD_SCALAR) {
+        kernels::evaporate_avx2(tau, count, keep, low);
+        return;
+    }
+#endif
+    kernels::evaporate_scalar(tau, count, keep, low);
+}
+
+/*  out[c] = choice[c] * open[cand[c]] for the k candidates of a city, where
+    open is 1 for the cities not yet visited and 0 for the others. Returns
+    the sum of out, the same on every instruction set */
+inline float open_weights(const float *choice, const int *cand, const float *open, int k, float *out) {
+#ifdef SIMD_DIST_X86
+    if (simd_support() != SIMD_SCALAR) {
+        return kernels::open_weights_avx2(choice, cand, open, k, out);
+    }
+#endif
+    return kernels::open_weights_scalar(choice, cand, open, k, out);
+}
+
+
+// Buffers of one thread, reused by every ant it runs
+struct ant_space {
+    vector<float> open;     // 1 if the city is not visited yet
+    vector<int> left;       // the open cities, in no order
+    vector<int> where;      // position of an open city in left
+    vector<float> weight;   // weights of the current city's candidates
+
+    ant_space(int n, int k) : open(n), left(n), where(n), weight(k) {}
+};
+
+
+// Builds one ant's tour from city start into order, returns its length
+template <class Dist>
+double construct(const Dist &dist, int n, int k, const int *cand, const float *choice, int start,
+                 ant_space &s, philox_rng &rng, int *order) {
+    float *open = s.open.data(), *weight = s.weight.data();
+    int *left = s.left.data(), *where = s.where.data();
+    for (int i = 0; i < n; i++) {
+        open[i] = 1;
+        left[i] = i;
+        where[i] = i;
+    }
+    int remaining = n;
+    int city = start;
+    double length = 0;
+    for (int step = 0;; step++) {
+        order[step] = city;
+        open[city] = 0;
+        int last = left[--remaining];
+        left[where[city]] = last;
+        where[last] = where[city];
+        if (remaining == 0) {
+            break;
+        }
+
+        const int *row = cand + (size_t)city * k;
+        float total = open_weights(choice + (size_t)city * k, row, open, k, weight);
+        int next = -1;
+        if (total > 0) {
+            // roulette wheel, ending on the last open candidate if rounding overshoots
+            float r = (float)(rng.uniform() * total);
+            float acc = 0;
+            for (int c = 0; c < k; c++) {
+                if (weight[c] > 0) {
+                    next = row[c];
+                    acc += weight[c];
+                    if (acc > r) {
+                        break;
+                    }
+                }
+            }
+        } else {
+            float best = FLT_MAX;
+            for (int i = 0; i < remaining; i++) {
+                float d = dist(city, left[i]);
+                if (d < best) {
+                    best = d;
+                    next = left[i];
+                }
+            }
+        }
+        length += dist(city, next);
+        city = next;
+    }
+    return length + dist(city, order[0]);
+}
+
+
+struct colony {
+    int n;
+    int ants;
+    unsigned long long seed;
+    double deadline;                // wall_time() to stop at, 0 for none
+    bound_monitor *monitor;
+    double opt_cost;
+    vector<int> opt_tour;
+    int iterations_run;
+    int resets;
+
+    colony(int n, int ants, unsigned long long seed, double deadline, bound_monitor *monitor)
+        : n(n), ants(ants), seed(seed), deadline(deadline), monitor(monitor), opt_cost(DBL_MAX),
+          iterations_run(0), resets(0) {}
+
+    // Adds deposit to both directions of every tour edge that is a candidate edge
+    void deposit(float *tau, const int *cand, int k, const int *order, float amount, float tau_max) {
+        for (int i = 0; i < n; i++) {
+            int a = order[i], b = order[i + 1 == n ? 0 : i + 1];
+            for (int side = 0; side < 2; side++) {
+                const int *row = cand + (size_t)a * k;
+                for (int c = 0; c < k; c++) {
+                    if (row[c] == b) {
+                        float &t = tau[(size_t)a * k + c];
+                        t = min(t + amount, tau_max);
+                        break;
+                    }
+                }
+                swap(a, b);
+            }
+        }
+    }
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        if (n < 4) {
+            // a single tour
+            for (int i = 0; i < n; i++) {
+                opt_tour.push_back(i);
+            }
+            opt_cost = n > 1 ? tour_length_order(dist, opt_tour.data(), n) : 0;
+            return;
+        }
+        int k = min(CANDIDATES, n - 1);
+        size_t edges = (size_t)n * k;
+        vector<int> cand(edges);
+        candidate_builder builder = {n, k, cand.data()};
+        builder(dist);
+
+        // eta^BETA relative to the mean nearest neighbour distance, so it stays well within float range
+        double nearest = 0;
+        for (int i = 0; i < n; i++) {
+            nearest += dist(i, cand[(size_t)i * k]);
+        }
+        nearest = max(nearest / n, 1e-9);
+        vector<float> eta(edges);
+        for (size_t e = 0; e < edges; e++) {
+            double d = max((double)dist((int)(e / k), cand[e]), 1e-3 * nearest);
+            eta[e] = (float)pow(nearest / d, BETA);
+        }
+        vector<float> tau(edges, 1.0f), choice(edges);
+
+        vector<int> tours((size_t)ants * n);
+        vector<double> lengths(ants);
+        vector<int> best_order(n);
+        double best_cost = DBL_MAX;
+        int since_improved = 0;
+        bool stop = false;
+        // the colony picks among about k / 2 candidates per step once converged
+        double pdec = pow(PBEST, 1.0 / n);
+        double spread = (1 - pdec) / (max(2.0, k / 2.0) - 1) / pdec;
+
+        product(tau.data(), eta.data(), choice.data(), edges);
+        #pragma omp parallel
+        {
+            ant_space space(n, k);
+            for (int it = 0; it < ITERATIONS; it++) {
+                #pragma omp for schedule(dynamic, 1)
+                for (int a = 0; a < ants; a++) {
+                    PERF_REGION("aco_construct");
+                    philox_rng gen(seed, it, a, STREAM_ANTS);
+                    int start = gen.below(n);
+                    lengths[a] = construct(dist, n, k, cand.data(), choice.data(), start, space, gen,
+                                           tours.data() + (size_t)a * n);
+                }
+                #pragma omp single
+                {
+                    PERF_REGION("aco_update");
+                    int pick = 0;
+                    for (int a = 1; a < ants; a++) {
+                        if (lengths[a] < lengths[pick]) {
+                            pick = a;
+                        }
+                    }
+                    const int *iteration_best = tours.data() + (size_t)pick * n;
+                    if (lengths[pick] < best_cost) {
+                        best_cost = lengths[pick];
+                        copy(iteration_best, iteration_best + n, best_order.begin());
+                        since_improved = 0;
+                    } else {
+                        since_improved++;
+                    }
+
+                    float tau_max = (float)(1 / (RHO * best_cost));
+                    float tau_min = (float)min(tau_max * spread, (double)tau_max);
+                    if (it == 0 || since_improved == STAGNATION) {
+                        fill(tau.begin(), tau.end(), tau_max);
+                        if (it > 0) {
+                            resets++;
+                            since_improved = 0;
+                        }
+                    } else {
+                        evaporate(tau.data(), edges, (float)(1 - RHO), tau_min);
+                        if (it % GLOBAL_EVERY == 0) {
+                            deposit(tau.data(), cand.data(), k, best_order.data(), (float)(1 / best_cost), tau_max);
+                        } else {
+                            deposit(tau.data(), cand.data(), k, iteration_best, (float)(1 / lengths[pick]), tau_max);
+                        }
+                    }
+
+                    {
+                        PERF_REGION("aco_choice");
+                        product(tau.data(), eta.data(), choice.data(), edges);
+                    }
+                    iterations_run++;
+                    if (monitor) {
+                        monitor->offer_upper(best_cost);
+                        stop = monitor->reached();
+                    }
+                    stop = stop || (deadline > 0 && wall_time() > deadline);
+                }
+                // read after the barrier ending single, so every thread leaves together
+                if (stop) {
+                    break;
+                }
+            }
+        }
+
+        opt_cost = best_cost;
+        opt_tour = best_order;
+    }
+};
+
+
+// Number of ants used when none is given
+int default_ants(int max_threads) {
+    return max(MIN_ANTS, max_threads);
+}
+
+
+// Returns the polished best tour the colony built, stopping early at opts.time_limit
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    int n = inst.n;
+    int ants = opts.runs > 0 ? opts.runs : default_ants(omp_get_max_threads());
+    double deadline = opts.time_limit > 0 ? wall_time() + opts.time_limit : 0;
+    colony solver(n, ants, opts.seed, deadline, opts.monitor);
+    dispatch_metric(inst, solver);
+
+    tsp_result result;
+    result.tour.swap(solver.opt_tour);
+    result.cost = n > 3 ? lin_kern::improve(inst, result.tour) : solver.opt_cost;
+    if (opts.monitor) {
+        opts.monitor->offer_upper(result.cost);
+    }
+    normalize_tour(result.tour);
+    mark_phase(timer, PHASE_SOLVE);
+
+    result.stats.push_back(tsp_stat("ants", ants));
+    result.stats.push_back(tsp_stat("iterations", solver.iterations_run));
+    result.stats.push_back(tsp_stat("resets", solver.resets));
+    result.stats.push_back(tsp_stat("colony_cost", solver.opt_cost));
+    return result;
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
+int main(int argc, char *argv[]) {
+    string file_name = "";
+    tsp_options opts;
+    int num_threads = omp_get_max_threads();
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            file_name = argv[i + 1];
+        } else if (arg == "-r" && i + 1 < argc) {
+            opts.runs = atoi(argv[i + 1]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (arg == "-seed" && i + 1 < argc) {
+            opts.seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (arg == "-time" && i + 1 < argc) {
+            opts.time_limit = atof(argv[i + 1]);
+        }
+    }
+
+    if (file_name == "") {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
+    }
+
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
+    if (!is_symmetric(inst)) {
+        cout << "Ant colony needs a symmetric instance" << endl;
+        return 1;
+    }
+
+    if (opts.runs == 0) {
+        opts.runs = aco::default_ants(num_threads);
+    }
+    omp_set_num_threads(num_threads);
+    cout << "Running with " << num_threads << " threads" << endl;
+    cout << opts.runs << " ants" << endl;
+
+    tsp_result result = aco::solve(inst, opts);
+    for (size_t i = 0; i < result.stats.size(); i++) {
+        cout << result.stats[i].name << " = " << result.stats[i].value << endl;
+    }
+    cout << "Tour cost = " << setprecision(12) << result.cost << endl;
+    return 0;
+}
+#endif
@@ -0,0 +1,455 @@
+/*  Parallel tempering simulated annealing for the symmetric TSP
+    Input: any symmetric instance the parser reads.
+    Output: The best tour found.
+    Every replica anneals its own tour at one temperature of a geometric ladder
+    with random 2-opt and Or-opt moves towards the CANDIDATES nearest
+    neighbours of a city. A move changes at most three edges, so its cost is
+    evaluated in O(1) distance lookups; only accepted moves touch the tour,
+    reversing the shorter side of it. The replicas run in parallel for an
+    epoch of EPOCH_MOVES moves per city, then neighbouring temperatures swap
+    replicas with the Metropolis rule (even pairs after even epochs, odd pairs
+    after odd ones). Swaps only exchange entries of the temperature to replica
+    table, between epochs, so they need no locks, and since every random draw
+    is addressed by (epoch, temperature) the tour does not depend on the
+    thread count. The whole ladder cools geometrically over the run, and the
+    final tours are polished by greedy descent with the same moves.
+*/
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "../common/rng.h"
+#include "../libtsp/tsp.h"
+#include "../common/perf.h"
+
+using namespace std;
+
+namespace annealing {
+
+const int CANDIDATES = 8;
+const int MIN_REPLICAS = 8;
+const int EPOCHS = 100;
+const int EPOCH_MOVES = 20;
+// Ladder at the first epoch, in mean nearest neighbour distances
+const double HOT = 3.0;
+const double COLD = 0.03;
+// Factor the ladder has cooled by at the last epoch
+const double FINAL = 0.03;
+
+
+// Tour in visiting order with the position of every city
+struct tour_state {
+    int n;
+    vector<int> order;
+    vector<int> pos;
+    double cost;
+
+    int next(int c) const {
+        int p = pos[c] + 1;
+        return order[p == n ? 0 : p];
+    }
+
+    int prev(int c) const {
+        int p = pos[c];
+        return order[p == 0 ? n - 1 : p - 1];
+    }
+
+    // Reverses the len cities from position start on, wrapping around
+    void reverse(int start, int len) {
+        int *o = order.data(), *q = pos.data();
+        int i = start;
+        int j = start + len - 1;
+        if (j >= n) {
+            j -= n;
+        }
+        for (int s = 0; s < len / 2; s++) {
+            int a = o[i], b = o[j];
+            o[i] = b;
+            q[b] = i;
+            o[j] = a;
+            q[a] = j;
+            if (++i == n) {
+                i = 0;
+            }
+            if (--j < 0) {
+                j = n - 1;
+            }
+        }
+    }
+
+    /*  Reverses the path from city a forward to city b, or the rest of the
+        tour if that is shorter, which leaves the same cycle */
+    void reverse_path(int a, int b) {
+        int len = pos[b] - pos[a];
+        if (len < 0) {
+            len += n;
+        }
+        len++;
+        if (2 * len > n) {
+            reverse(pos[b] + 1 == n ? 0 : pos[b] + 1, n - len);
+        } else {
+            reverse(pos[a], len);
+        }
+    }
+};
+
+
+enum move_type {
+    MOVE_2OPT_NEXT,     // replaces (a, next a) and (b, next b) with (a, b) and (next a, next b)
+    MOVE_2OPT_PREV,     // replaces (prev a, a) and (prev b, b) with (a, b) and (prev a, prev b)
+    MOVE_OR_OPT         // moves the len cities from a on between b and next b
+};
+
+struct tour_move {
+    move_type type;
+    int a, b, len;
+    bool reversed;      // Or-opt inserts the segment backwards, b then its last city
+    double delta;
+};
+
+
+// Fills in m.delta, returns false if the move does not apply to the tour
+template <class Dist>
+bool evaluate(const Dist &dist, const tour_state &s, tour_move &m) {
+    int n = s.n, a = m.a, b = m.b;
+    if (m.type == MOVE_2OPT_NEXT) {
+        int na = s.next(a), nb = s.next(b);
+        if (b == a || b == na || nb == a) {
+            return false;
+        }
+        m.delta = dist(a, b) + dist(na, nb) - dist(a, na) - dist(b, nb);
+    } else if (m.type == MOVE_2OPT_PREV) {
+        int pa = s.prev(a), pb = s.prev(b);
+        if (b == a || b == pa || pb == a) {
+            return false;
+        }
+        m.delta = dist(a, b) + dist(pa, pb) - dist(pa, a) - dist(pb, b);
+    } else {
+        if (n - m.len < 3) {
+            return false;
+        }
+        int offset = s.pos[b] - s.pos[a];
+        if (offset < 0) {
+            offset += n;
+        }
+        int p = s.prev(a);
+        if (offset < m.len || b == p) {
+            return false;
+        }
+        int e = s.order[(s.pos[a] + m.len - 1) % n];
+        int nx = s.next(e), nb = s.next(b);
+        double base = dist(p, nx) - dist(p, a) - dist(e, nx) - dist(b, nb);
+        double forward = dist(b, a) + dist(e, nb);
+        double backward = dist(b, e) + dist(a, nb);
+        m.reversed = backward < forward;
+        m.delta = base + (m.reversed ? backward : forward);
+    }
+    return true;
+}
+
+
+/*  Applies an evaluated move. Or-opt rotates the segment past the shorter of
+    the two paths between it and its new place with three reversals */
+void apply(tour_state &s, const tour_move &m) {
+    int n = s.n;
+    if (m.type == MOVE_2OPT_NEXT) {
+        s.reverse_path(s.next(m.a), m.b);
+    } else if (m.type == MOVE_2OPT_PREV) {
+        s.reverse_path(m.b, s.prev(m.a));
+    } else {
+        int i = s.pos[m.a];
+        int ahead = s.pos[m.b] - (i + m.len);
+        ahead = (ahead % n + n) % n + 1;
+        int behind = n - m.len - ahead;
+        if (ahead <= behind) {
+            // segment, then the path up to b: reversed whole it ends at b
+            s.reverse(i, m.len + ahead);
+            s.reverse(i, ahead);
+            if (!m.reversed) {
+                s.reverse((i + ahead) % n, m.len);
+            }
+        } else {
+            // path from after b to before the segment, then the segment
+            int start = s.pos[s.next(m.b)];
+            s.reverse(start, behind + m.len);
+            s.reverse((start + m.len) % n, behind);
+            if (!m.reversed) {
+                s.reverse(start, m.len);
+            }
+        }
+    }
+    s.cost += m.delta;
+}
+
+
+// Draws a random move towards a candidate neighbour of a random city
+void random_move(philox_rng &rng, int n, const int *cand, int k, tour_move &m) {
+    m.a = rng.below(n);
+    m.b = cand[(size_t)m.a * k + rng.below(k)];
+    uint32_t r = rng.below(4);
+    if (r < 2) {
+        m.type = r == 0 ? MOVE_2OPT_NEXT : MOVE_2OPT_PREV;
+    } else {
+        m.type = MOVE_OR_OPT;
+        m.len = 1 + rng.below(3);
+    }
+}
+
+
+// Runs 'moves' Metropolis steps at temperature temp, returns the number accepted
+template <class Dist>
+long anneal(const Dist &dist, tour_state &s, const int *cand, int k, double temp, long moves,
+            philox_rng &rng) {
+    long accepted = 0;
+    tour_move m;
+    for (long i = 0; i < moves; i++) {
+        random_move(rng, s.n, cand, k, m);
+        if (!evaluate(dist, s, m)) {
+            continue;
+        }
+        if (m.delta <= 0 || rng.uniform() < exp(-m.delta / temp)) {
+            apply(s, m);
+            accepted++;
+        }
+    }
+    return accepted;
+}
+
+
+// Applies improving moves towards candidate neighbours until there are none
+template <class Dist>
+void descend(const Dist &dist, tour_state &s, const int *cand, int k) {
+    bool improved = true;
+    tour_move m;
+    while (improved) {
+        improved = false;
+        for (int a = 0; a < s.n; a++) {
+            m.a = a;
+            for (int c = 0; c < k; c++) {
+                m.b = cand[(size_t)a * k + c];
+                for (int t = 0; t < 5; t++) {
+                    m.type = t < 2 ? (move_type)t : MOVE_OR_OPT;
+                    m.len = t - 1;
+                    if (evaluate(dist, s, m) && m.delta < -1e-7) {
+                        apply(s, m);
+                        improved = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+struct tempering {
+    int n;
+    int replicas;
+    unsigned long long seed;
+    double deadline;                // wall_time() to stop at, 0 for none
+    bound_monitor *monitor;
+    double opt_cost;
+    vector<int> opt_tour;
+    int epochs_run;
+    long exchanges;
+    long exchanges_tried;
+    long accepted;
+
+    tempering(int n, int replicas, unsigned long long seed, double deadline, bound_monitor *monitor)
+        : n(n), replicas(replicas), seed(seed), deadline(deadline), monitor(monitor), opt_cost(DBL_MAX),
+          epochs_run(0), exchanges(0), exchanges_tried(0), accepted(0) {}
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        if (n < 4) {
+            // a single tour
+            for (int i = 0; i < n; i++) {
+                opt_tour.push_back(i);
+            }
+            opt_cost = n > 1 ? tour_length_order(dist, opt_tour.data(), n) : 0;
+            return;
+        }
+        int k = min(CANDIDATES, n - 1);
+        vector<int> cand((size_t)n * k);
+        candidate_builder builder = {n, k, cand.data()};
+        builder(dist);
+        double nearest = 0;
+        for (int i = 0; i < n; i++) {
+            nearest += dist(i, cand[(size_t)i * k]);
+        }
+        nearest = max(nearest / n, 1e-9);
+
+        vector<tour_state> tours(replicas);
+        for (int r = 0; r < replicas; r++) {
+            tour_state &s = tours[r];
+            s.n = n;
+            s.order.resize(n);
+            s.pos.resize(n);
+            for (int i = 0; i < n; i++) {
+                s.order[i] = i;
+            }
+            philox_rng gen(seed, 0, r, STREAM_SHUFFLE);
+            rng_shuffle(s.order.data(), n, gen);
+            for (int i = 0; i < n; i++) {
+                s.pos[s.order[i]] = i;
+            }
+            s.cost = tour_length_order(dist, s.order.data(), n);
+        }
+
+        // slot[t] is the replica at the t-th temperature, hottest first
+        vector<int> slot(replicas);
+        vector<double> ladder(replicas);
+        for (int t = 0; t < replicas; t++) {
+            slot[t] = t;
+            ladder[t] = HOT * nearest * pow(COLD / HOT, t / (double)max(1, replicas - 1));
+        }
+        vector<long> counts(replicas);
+        vector<int> best_order;
+        double best_cost = DBL_MAX;
+
+        for (int e = 0; e < EPOCHS; e++) {
+            double scale = pow(FINAL, e / (double)(EPOCHS - 1));
+            #pragma omp parallel for schedule(static)
+            for (int t = 0; t < replicas; t++) {
+                PERF_REGION("anneal_epoch");
+                philox_rng gen(seed, e, t, STREAM_ANNEAL);
+                counts[t] = anneal(dist, tours[slot[t]], cand.data(), k, ladder[t] * scale,
+                                   (long)EPOCH_MOVES * n, gen);
+            }
+            epochs_run++;
+            for (int t = 0; t < replicas; t++) {
+                accepted += counts[t];
+                tour_state &s = tours[slot[t]];
+                if (s.cost < best_cost) {
+                    best_cost = s.cost;
+                    best_order = s.order;
+                }
+            }
+
+            philox_rng gen(seed, e, 0, STREAM_EXCHANGE);
+            for (int t = e % 2; t + 1 < replicas; t += 2) {
+                double hot = 1 / (ladder[t] * scale), cold = 1 / (ladder[t + 1] * scale);
+                double x = (hot - cold) * (tours[slot[t]].cost - tours[slot[t + 1]].cost);
+                exchanges_tried++;
+                if (x >= 0 || gen.uniform() < exp(x)) {
+                    swap(slot[t], slot[t + 1]);
+                    exchanges++;
+                }
+            }
+
+            if (monitor) {
+                monitor->offer_upper(best_cost);
+                if (monitor->reached()) {
+                    break;
+                }
+            }
+            if (deadline > 0 && wall_time() > deadline) {
+                break;
+            }
+        }
+
+        // Polish the final tours and the best one seen, keep the lowest
+        tour_state &best = tours[slot[0]];
+        best.order = best_order;
+        for (int i = 0; i < n; i++) {
+            best.pos[best_order[i]] = i;
+        }
+        best.cost = best_cost;
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int r = 0; r < replicas; r++) {
+            descend(dist, tours[r], cand.data(), k);
+            tours[r].cost = tour_length_order(dist, tours[r].order.data(), n);
+        }
+        int pick = 0;
+        for (int r = 1; r < replicas; r++) {
+            if (tours[r].cost < tours[pick].cost) {
+                pick = r;
+            }
+        }
+        opt_cost = tours[pick].cost;
+        opt_tour = tours[pick].order;
+        normalize_tour(opt_tour);
+    }
+};
+
+
+// Number of replicas used when none is given
+int default_replicas(int max_threads) {
+    return max(MIN_REPLICAS, max_threads);
+}
+
+
+// Returns the best tour of the replicas, stopping early at opts.time_limit
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    int n = inst.n;
+    int replicas = opts.runs > 0 ? opts.runs : default_replicas(omp_get_max_threads());
+    double deadline = opts.time_limit > 0 ? wall_time() + opts.time_limit : 0;
+    tempering solver(n, replicas, opts.seed, deadline, opts.monitor);
+    dispatch_metric(inst, solver);
+    mark_phase(timer, PHASE_SOLVE);
+
+    tsp_result result;
+    result.cost = solver.opt_cost;
+    result.tour.swap(solver.opt_tour);
+    result.stats.push_back(tsp_stat("replicas", replicas));
+    result.stats.push_back(tsp_stat("epochs", solver.epochs_run));
+    result.stats.push_back(tsp_stat("acceptance", solver.accepted / (max(1, solver.epochs_run) * (double)replicas * EPOCH_MOVES * n)));
+    result.stats.push_back(tsp_stat("exchange_rate", solver.exchanges_tried ? solver.exchanges / (double)solver.exchanges_tried : 0));
+    return result;
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
+int main(int argc, char *argv[]) {
+    string file_name = "";
+    tsp_options opts;
+    int num_threads = omp_get_max_threads();
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            file_name = argv[i + 1];
+        } else if (arg == "-r" && i + 1 < argc) {
+            opts.runs = atoi(argv[i + 1]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (arg == "-seed" && i + 1 < argc) {
+            opts.seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (arg == "-time" && i + 1 < argc) {
+            opts.time_limit = atof(argv[i + 1]);
+        }
+    }
+
+    if (file_name == "") {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
+    }
+
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
+    if (!is_symmetric(inst)) {
+        cout << "Annealing needs a symmetric instance" << endl;
+        return 1;
+    }
+
+    if (opts.runs == 0) {
+        opts.runs = annealing::default_replicas(num_threads);
+    }
+    omp_set_num_threads(num_threads);
+    cout << "Running with " << num_threads << " threads" << endl;
+    cout << opts.runs << " replicas" << endl;
+
+    tsp_result result = annealing::solve(inst, opts);
+    for (size_t i = 0; i < result.stats.size(); i++) {
+        cout << result.stats[i].name << " = " << result.stats[i].value << endl;
+    }
+    cout << "Tour cost = " << setprecision(12) << result.cost << endl;
+    return 0;
+}
+#endif
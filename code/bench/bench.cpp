@@ -0,0 +1,732 @@
+/*  In-process benchmark harness for the solvers
+    Links the solvers as libraries and times every run phase by phase (parse,
+    alloc, solve, reconstruct), so numbers exclude process startup and output.
+    Usage: ./bench [-b BENCH] [-a ALGOS] [-f INSTANCES] [-t THREADS] [-r RUNS]
+                   [-w WARMUP] [-seed N] [-o OUT_CSV] [-j OUT_JSON] [-u] [-tol FRACTION]
+      -b BENCH      preset from benchmark.py: scale, eff or acc, each writes
+                    the matching results/*.csv, or regress or calibrate (see
+                    below)
+      -a ALGOS      comma separated list of hk, lk, gen, sa, cluster, aco and bb
+                    (default all but bb, which only regress runs by default)
+      -f INSTANCES  comma separated instance files (default per algorithm)
+      -t THREADS    comma separated thread counts (default 2,4,8), the
+                    largest is used by eff and acc
+      -r RUNS       measured repetitions per configuration (default 5, 3 for
+                    regress, 1 for calibrate)
+      -w WARMUP     unmeasured repetitions before those (default 1, 0 for
+                    calibrate)
+      -o OUT_CSV    per phase median and p95 of every configuration as CSV
+      -j OUT_JSON   the same as JSON
+      -u            regress: update results/baseline.csv instead of comparing
+      -tol FRACTION regress: also fail runs more than FRACTION slower than the
+                    baseline (timings are not compared without it)
+    Every configuration also runs a sequential implementation: seq_hk for hk,
+    one thread for the others.
+
+    The regress preset runs a fixed suite with fixed seeds and exits with
+    status 1 if any run fails a check: every tour must visit each city once
+    and have the reported length, the exact solvers (Held-Karp and branch and
+    bound) must find the known optimum, and against results/baseline.csv no
+    cost may get worse. Median times depend on the machine, so they are only
+    compared with -tol, against a baseline written with -u on the same
+    machine: none may then grow by more than the tolerance (plus 5 ms, below
+    which timings are noise).
+
+    The calibrate preset runs every solver (bb included) on instances of
+    growing size with all cores (or the largest thread count given), fits the cost model of each
+    solver and kind of instance that the tsp program's auto mode selects
+    with (see libtsp/select.cpp) and writes it to results/profile.txt. With
+    -a only those solvers are calibrated again and the others keep their
+    models.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "../libtsp/tsp.h"
+
+using namespace std;
+
+
+// Median and 95th percentile of a set of repetitions
+struct summary {
+    double median;
+    double p95;
+};
+
+// Measurements of one (algorithm, instance, implementation, threads) configuration
+struct bench_result {
+    string algo;
+    string instance;
+    bool seq;
+    int threads;
+    int reps;
+    double cost;
+    string tour_error;        // why the last tour is wrong, empty if it is valid
+    summary phases[PHASE_COUNT];
+    summary total;
+};
+
+// Instances each algorithm runs by default, as in benchmark.py
+map<string, vector<string> > instance_dict = {
+    {"hk", {"br17.mat", "gr21.mat", "gr24.mat", "fri26.mat"}},
+    {"lk", {"br17.mat", "gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp",
+             "u159.tsp", "si175.mat", "kroA200.tsp"}},
+    {"gen", {"br17.mat", "gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp",
+             "u159.tsp", "si175.mat", "kroA200.tsp"}},
+    {"bb", {"gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp"}},
+    {"sa", {"gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp", "u159.tsp", "si175.mat",
+            "kroA200.tsp"}},
+    {"cluster", {"gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp", "u159.tsp", "si175.mat",
+                 "kroA200.tsp"}},
+    {"aco", {"gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp", "u159.tsp", "si175.mat",
+             "kroA200.tsp"}}
+};
+
+// Smaller suite of the regress preset
+map<string, vector<string> > regress_dict = {
+    {"hk", {"br17.mat", "gr21.mat"}},
+    {"bb", {"gr21.mat", "fri26.mat", "st70.tsp"}},
+    {"lk", {"br17.mat", "gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp"}},
+    {"gen", {"br17.mat", "gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp"}},
+    {"sa", {"gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp"}},
+    {"cluster", {"gr21.mat", "fri26.mat", "st70.tsp", "lin105.tsp"}},
+    {"aco", {"gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp"}}
+};
+
+// Instances of the calibrate preset, from a fraction of a second to a few seconds per solve
+map<string, vector<string> > calibrate_dict = {
+    {"hk", {"br17.mat", "gr21.mat"}},
+    {"bb", {"gr21.mat", "gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp"}},
+    {"lk", {"gr24.mat", "fri26.mat", "si175.mat", "st70.tsp", "lin105.tsp", "u159.tsp", "kroA200.tsp"}},
+    {"gen", {"gr24.mat", "fri26.mat", "st70.tsp", "lin105.tsp"}},
+    {"sa", {"gr24.mat", "fri26.mat", "si175.mat", "st70.tsp", "lin105.tsp", "u159.tsp", "kroA200.tsp"}},
+    {"cluster", {"gr24.mat", "fri26.mat", "si175.mat", "st70.tsp", "lin105.tsp", "u159.tsp", "kroA200.tsp",
+                 "a280.tsp", "lin318.tsp"}},
+    {"aco", {"gr24.mat", "fri26.mat", "si175.mat", "st70.tsp", "lin105.tsp", "u159.tsp", "kroA200.tsp",
+             "a280.tsp", "lin318.tsp"}}
+};
+
+// Optimal tour lengths of the shipped instances, from TSPLIB
+map<string, double> known_optima = {
+    {"br17", 39}, {"gr21", 2707}, {"gr24", 1272}, {"fri26", 937}, {"st70", 675},
+    {"lin105", 14379}, {"u159", 42080}, {"si175", 21407}, {"kroA200", 29368},
+    {"a280", 2579}, {"lin318", 42029}, {"u1060", 224094}, {"u2319", 234256}
+};
+
+int run_count = 5;
+int warmup_count = 1;
+unsigned long long seed = 0;
+int machine_threads = omp_get_max_threads();
+
+
+vector<string> split(string s) {
+    vector<string> parts;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos) {
+            end = s.size();
+        }
+        if (end > start) {
+            parts.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return parts;
+}
+
+// Instance name without directory or extension, as benchmark.py reports it
+string stem(string file_name) {
+    size_t slash = file_name.find_last_of('/');
+    if (slash != string::npos) {
+        file_name = file_name.substr(slash + 1);
+    }
+    return file_name.substr(0, file_name.find('.'));
+}
+
+// Formats a value like benchmark.py's round(x, 4)
+string fmt(double x, int digits = 4) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", digits, x);
+    string s(buf);
+    if (s.find('.') != string::npos) {
+        s.erase(s.find_last_not_of('0') + 1);
+        if (s.back() == '.') {
+            s += "0";
+        }
+    }
+    return s;
+}
+
+summary summarize(vector<double> v) {
+    sort(v.begin(), v.end());
+    int k = v.size();
+    summary s;
+    s.median = k % 2 ? v[k / 2] : (v[k / 2 - 1] + v[k / 2]) / 2;
+    s.p95 = v[max(0, (int)ceil(0.95 * k) - 1)];
+    return s;
+}
+
+// Runs one solver on a parsed instance with the given thread count
+tsp_result run_solver(string algo, bool seq, const dist_data &inst, int threads, phase_timer *timer) {
+    const tsp_solver *solver = find_solver(algo == "hk" && seq ? "hk_seq" : algo);
+    tsp_options opts;
+    opts.threads = threads;
+    opts.seed = seed;
+    // as many restarts (replicas, ants) as the lin_kern (annealing, aco)
+    // program picks on this machine, so every thread count does the same work
+    if (algo == "lk") {
+        opts.runs = lin_kern::default_runs(inst.n, machine_threads);
+    } else if (algo == "sa") {
+        opts.runs = annealing::default_replicas(machine_threads);
+    } else if (algo == "aco") {
+        opts.runs = aco::default_ants(machine_threads);
+    }
+    return tsp_solve(*solver, inst, opts, timer);
+}
+
+/*  Times 'reps' runs of one configuration after 'warmup' unmeasured ones
+    The instance is parsed again for every run so parsing is measured too */
+bench_result measure(string algo, string file_name, bool seq, int threads, int warmup, int reps) {
+    bench_result result;
+    result.algo = algo;
+    result.instance = stem(file_name);
+    result.seq = seq;
+    result.threads = seq ? 1 : threads;
+    result.reps = reps;
+
+    string path = instance_path(file_name);
+    vector<double> seconds[PHASE_COUNT];
+    vector<double> totals;
+    for (int r = 0; r < warmup + reps; r++) {
+        phase_timer timer;
+        dist_data inst;
+        parse_instance(path, inst);
+        precompute_dist_table(inst);
+        timer.mark(PHASE_PARSE);
+        tsp_result run = run_solver(algo, seq, inst, result.threads, &timer);
+        result.cost = run.cost;
+        double length = tour_cost(inst, run.tour);
+        if (length < 0) {
+            result.tour_error = "tour does not visit every city once";
+        } else if (fabs(length - run.cost) > 1e-6 * max(1.0, run.cost)) {
+            result.tour_error = "tour length " + fmt(length, 6) + " differs from the cost";
+        }
+        if (r < warmup) {
+            continue;
+        }
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            seconds[p].push_back(timer.seconds[p]);
+        }
+        totals.push_back(timer.total());
+    }
+
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        result.phases[p] = summarize(seconds[p]);
+    }
+    result.total = summarize(totals);
+
+    printf("%s %s %s threads = %d: cost = %.12g, median = %.4f s, p95 = %.4f s (",
+           algo.c_str(), result.instance.c_str(), seq ? "seq" : "par", result.threads,
+           result.cost, result.total.median, result.total.p95);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        printf("%s%s %.4f", p ? ", " : "", phase_names[p], result.phases[p].median);
+    }
+    printf(")\n");
+    fflush(stdout);
+    return result;
+}
+
+// Checks that an instance fits the algorithm before running it
+bool runnable(string algo, string file_name) {
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    string error = refusal(*find_solver(algo), inst);
+    if (error != "") {
+        printf("Skipping %s, %s\n", file_name.c_str(), error.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+void write_csv_rows(string path, vector<vector<string> > &rows) {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        printf("Could not write %s\n", path.c_str());
+        return;
+    }
+    for (size_t i = 0; i < rows.size(); i++) {
+        for (size_t j = 0; j < rows[i].size(); j++) {
+            fprintf(out, "%s%s", j ? "," : "", rows[i][j].c_str());
+        }
+        fprintf(out, "\r\n");
+    }
+    fclose(out);
+    printf("Wrote %s\n", path.c_str());
+}
+
+void write_phase_csv(string path, vector<bench_result> &results) {
+    vector<vector<string> > rows;
+    vector<string> header = {"algorithm", "instance", "impl", "threads", "reps", "cost"};
+    for (int p = 0; p <= PHASE_COUNT; p++) {
+        string name = p < PHASE_COUNT ? phase_names[p] : "total";
+        header.push_back(name + "_median");
+        header.push_back(name + "_p95");
+    }
+    rows.push_back(header);
+    for (size_t i = 0; i < results.size(); i++) {
+        bench_result &r = results[i];
+        vector<string> row = {r.algo, r.instance, r.seq ? "seq" : "par", to_string(r.threads),
+                              to_string(r.reps), fmt(r.cost, 0)};
+        for (int p = 0; p <= PHASE_COUNT; p++) {
+            summary s = p < PHASE_COUNT ? r.phases[p] : r.total;
+            row.push_back(fmt(s.median, 6));
+            row.push_back(fmt(s.p95, 6));
+        }
+        rows.push_back(row);
+    }
+    write_csv_rows(path, rows);
+}
+
+void write_phase_json(string path, vector<bench_result> &results) {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        printf("Could not write %s\n", path.c_str());
+        return;
+    }
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        bench_result &r = results[i];
+        fprintf(out, "  {\"algorithm\": \"%s\", \"instance\": \"%s\", \"impl\": \"%s\", "
+                "\"threads\": %d, \"reps\": %d, \"cost\": %.12g,\n   \"phases\": {",
+                r.algo.c_str(), r.instance.c_str(), r.seq ? "seq" : "par", r.threads, r.reps, r.cost);
+        for (int p = 0; p <= PHASE_COUNT; p++) {
+            summary s = p < PHASE_COUNT ? r.phases[p] : r.total;
+            fprintf(out, "%s\"%s\": {\"median\": %.9f, \"p95\": %.9f}", p ? ", " : "",
+                    p < PHASE_COUNT ? phase_names[p] : "total", s.median, s.p95);
+        }
+        fprintf(out, "}}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "]\n");
+    fclose(out);
+    printf("Wrote %s\n", path.c_str());
+}
+
+
+/*  Sequential run then each thread count, one row per instance:
+    algorithm, instance, seq, t1, t2, ... as in results/scale.csv */
+void run_scale(string algo, vector<string> &instances, vector<int> &threads, vector<bench_result> &all) {
+    vector<vector<string> > rows;
+    for (size_t i = 0; i < instances.size(); i++) {
+        if (!runnable(algo, instances[i])) {
+            continue;
+        }
+        // fri26 takes minutes per Held-Karp run, benchmark.py also runs it twice
+        int reps = algo == "hk" && stem(instances[i]) == "fri26" ? min(run_count, 2) : run_count;
+        vector<string> row = {algo, stem(instances[i])};
+        bench_result r = measure(algo, instances[i], true, 1, warmup_count, reps);
+        all.push_back(r);
+        row.push_back(fmt(r.total.median));
+        for (size_t t = 0; t < threads.size(); t++) {
+            r = measure(algo, instances[i], false, threads[t], warmup_count, reps);
+            all.push_back(r);
+            row.push_back(fmt(r.total.median));
+        }
+        rows.push_back(row);
+    }
+    write_csv_rows("results/scale_" + algo + ".csv", rows);
+}
+
+/*  Every algorithm at the largest thread count on the lk instances, one
+    column per algorithm, either the median time (eff) or the cost (acc)
+    With the default instances an algorithm only runs its own ones */
+void run_table(string name, vector<string> &algos, vector<string> &instances, bool own_only,
+               int threads, vector<bench_result> &all) {
+    bool acc = name == "acc";
+    vector<vector<string> > rows;
+    vector<string> header = {""};
+    header.insert(header.end(), algos.begin(), algos.end());
+    rows.push_back(header);
+    for (size_t i = 0; i < instances.size(); i++) {
+        vector<string> row = {stem(instances[i])};
+        for (size_t a = 0; a < algos.size(); a++) {
+            vector<string> &own = instance_dict[algos[a]];
+            if ((own_only && find(own.begin(), own.end(), instances[i]) == own.end()) ||
+                !runnable(algos[a], instances[i])) {
+                row.push_back("");
+                continue;
+            }
+            // accuracy only needs the cost, so it runs once like benchmark.py
+            bench_result r = acc ? measure(algos[a], instances[i], false, threads, 0, 1)
+                                 : measure(algos[a], instances[i], false, threads, warmup_count, run_count);
+            all.push_back(r);
+            row.push_back(acc ? fmt(r.cost, 0) : fmt(r.total.median));
+        }
+        rows.push_back(row);
+    }
+    write_csv_rows("results/" + name + ".csv", rows);
+}
+
+
+// Baseline cost and median time of one configuration
+struct baseline_entry {
+    double cost;
+    double median;
+};
+
+string config_key(string algo, string instance, bool seq, int threads) {
+    return algo + "," + instance + "," + (seq ? "seq" : "par") + "," + to_string(threads);
+}
+
+// Reads results/baseline.csv as written by write_baseline, keyed by config_key
+map<string, baseline_entry> read_baseline(string path) {
+    map<string, baseline_entry> baseline;
+    FILE *in = fopen(path.c_str(), "r");
+    if (!in) {
+        return baseline;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        string row(line);
+        row.erase(row.find_last_not_of("\r\n") + 1);
+        vector<string> fields = split(row);
+        if (fields.size() < 7 || fields[0] == "algorithm") {
+            continue;
+        }
+        baseline_entry e = {atof(fields[4].c_str()), atof(fields[6].c_str())};
+        baseline[config_key(fields[0], fields[1], fields[2] == "seq", atoi(fields[3].c_str()))] = e;
+    }
+    fclose(in);
+    return baseline;
+}
+
+// Rewrites the baseline rows of the configurations in results in place, keeps the others and appends new ones
+void write_baseline(string path, vector<bench_result> &results) {
+    map<string, vector<string> > measured;
+    vector<string> order;
+    for (size_t i = 0; i < results.size(); i++) {
+        bench_result &r = results[i];
+        string gap = known_optima.count(r.instance) ? fmt(r.cost / known_optima[r.instance] - 1, 6) : "";
+        string key = config_key(r.algo, r.instance, r.seq, r.threads);
+        measured[key] = {r.algo, r.instance, r.seq ? "seq" : "par", to_string(r.threads), fmt(r.cost, 0),
+                         gap, fmt(r.total.median, 6), fmt(r.total.p95, 6)};
+        order.push_back(key);
+    }
+    vector<vector<string> > rows;
+    rows.push_back({"algorithm", "instance", "impl", "threads", "cost", "gap", "median", "p95"});
+    FILE *in = fopen(path.c_str(), "r");
+    char line[512];
+    while (in && fgets(line, sizeof(line), in)) {
+        string row(line);
+        row.erase(row.find_last_not_of("\r\n") + 1);
+        vector<string> fields = split(row);
+        if (fields.size() < 4 || fields[0] == "algorithm") {
+            continue;
+        }
+        string key = config_key(fields[0], fields[1], fields[2] == "seq", atoi(fields[3].c_str()));
+        if (measured.count(key)) {
+            rows.push_back(measured[key]);
+            measured.erase(key);
+        } else {
+            rows.push_back({row});
+        }
+    }
+    if (in) {
+        fclose(in);
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        if (measured.count(order[i])) {
+            rows.push_back(measured[order[i]]);
+            measured.erase(order[i]);
+        }
+    }
+    write_csv_rows(path, rows);
+}
+
+/*  Runs the regression suite and checks every result, see the top of this
+    file. Returns the number of failed checks */
+int run_regress(vector<string> &algos, vector<string> &instances, int threads, bool update,
+                double tolerance, vector<bench_result> &all) {
+    const string baseline_path = "results/baseline.csv";
+    map<string, baseline_entry> baseline = read_baseline(baseline_path);
+    if (!update && baseline.empty()) {
+        printf("No baseline in %s, only checking tours and optima (write one with -u)\n", baseline_path.c_str());
+    }
+
+    vector<string> failures;
+    for (size_t a = 0; a < algos.size(); a++) {
+        vector<string> &list = instances.empty() ? regress_dict[algos[a]] : instances;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (!runnable(algos[a], list[i])) {
+                continue;
+            }
+            for (int seq = 1; seq >= 0; seq--) {
+                bench_result r = measure(algos[a], list[i], seq, threads, warmup_count, run_count);
+                all.push_back(r);
+                string name = config_key(r.algo, r.instance, r.seq, r.threads);
+                if (r.tour_error != "") {
+                    failures.push_back(name + ": " + r.tour_error);
+                }
+                if (known_optima.count(r.instance)) {
+                    double opt = known_optima[r.instance];
+                    if (r.cost < opt || ((r.algo == "hk" || r.algo == "bb") && r.cost != opt)) {
+                        failures.push_back(name + ": cost " + fmt(r.cost, 0) + ", the optimum is " + fmt(opt, 0));
+                    }
+                }
+                if (update || !baseline.count(name)) {
+                    continue;
+                }
+                baseline_entry &base = baseline[name];
+                if (r.cost > base.cost) {
+                    failures.push_back(name + ": cost " + fmt(r.cost, 0) + ", baseline " + fmt(base.cost, 0));
+                } else if (r.cost < base.cost) {
+                    printf("%s: cost improved from %s to %s\n", name.c_str(), fmt(base.cost, 0).c_str(),
+                           fmt(r.cost, 0).c_str());
+                }
+                if (tolerance >= 0 && r.total.median > base.median * (1 + tolerance) + 0.005) {
+                    failures.push_back(name + ": median " + fmt(r.total.median) + " s, baseline " +
+                                       fmt(base.median) + " s");
+                }
+            }
+        }
+    }
+
+    if (update) {
+        write_baseline(baseline_path, all);
+    }
+    if (failures.empty()) {
+        printf("Regression suite passed, %d runs checked\n", (int)all.size());
+        return 0;
+    }
+    printf("\nREGRESSION: %d check%s failed\n", (int)failures.size(), failures.size() == 1 ? "" : "s");
+    for (size_t i = 0; i < failures.size(); i++) {
+        printf("FAIL %s\n", failures[i].c_str());
+    }
+    return failures.size();
+}
+
+
+// One calibration run: the solve time and the cost above the optimum
+struct calibration_sample {
+    string kind;
+    double n;
+    double seconds;
+    double excess;
+};
+
+/*  Fits the model of one solver per kind of instance, see tsp.h. The
+    exponent of n is shared by the kinds, fitted by least squares on the log
+    of the times with an intercept per kind, and the scale of each kind then
+    follows from its intercept. Held-Karp's work is known, so only its scale
+    is fitted */
+void fit_models(string algo, vector<calibration_sample> &samples, int threads, tsp_profile &profile) {
+    map<string, vector<calibration_sample> > kinds;
+    for (size_t i = 0; i < samples.size(); i++) {
+        kinds[samples[i].kind].push_back(samples[i]);
+    }
+    double num = 0, den = 0;
+    map<string, double> mean_x, mean_y;
+    for (auto &k : kinds) {
+        for (size_t i = 0; i < k.second.size(); i++) {
+            mean_x[k.first] += log(k.second[i].n) / k.second.size();
+            mean_y[k.first] += log(k.second[i].seconds) / k.second.size();
+        }
+        for (size_t i = 0; i < k.second.size(); i++) {
+            double dx = log(k.second[i].n) - mean_x[k.first];
+            num += dx * (log(k.second[i].seconds) - mean_y[k.first]);
+            den += dx * dx;
+        }
+    }
+    // a single size per kind says nothing about the growth, assume quadratic
+    double exponent = den > 0 ? min(6.0, max(1.0, num / den)) : 2;
+
+    for (auto &k : kinds) {
+        vector<calibration_sample> &v = k.second;
+        solver_model m = {algo, k.first, 0, algo == "hk" ? 0 : exponent, 0, threads, 0};
+        for (size_t i = 0; i < v.size(); i++) {
+            m.excess += max(0.0, v[i].excess) / v.size();
+            m.max_n = max(m.max_n, (int)v[i].n);
+            if (algo == "hk") {
+                m.scale += v[i].seconds / ldexp(v[i].n * v[i].n, (int)v[i].n) / v.size();
+            }
+        }
+        if (algo != "hk") {
+            m.scale = exp(mean_y[k.first] - exponent * mean_x[k.first]);
+        }
+        printf("%s %s: scale = %.3g, exponent = %.3g, excess = %.4f\n", algo.c_str(), k.first.c_str(), m.scale,
+               m.exponent, m.excess);
+        profile.models.push_back(m);
+    }
+}
+
+/*  Runs the calibration sweep and writes results/profile.txt, keeping the
+    models of the solvers not calibrated this time. lk runs as many restarts
+    as lin_kern picks, so its time is divided by their number */
+void run_calibrate(vector<string> &algos, int threads, vector<bench_result> &all) {
+    const string path = "results/profile.txt";
+    tsp_profile profile;
+    if (profile.load(path)) {
+        vector<solver_model> kept;
+        for (size_t i = 0; i < profile.models.size(); i++) {
+            if (find(algos.begin(), algos.end(), profile.models[i].solver) == algos.end()) {
+                kept.push_back(profile.models[i]);
+            }
+        }
+        profile.models.swap(kept);
+    }
+    for (size_t a = 0; a < algos.size(); a++) {
+        vector<calibration_sample> samples;
+        vector<string> &list = calibrate_dict[algos[a]];
+        for (size_t i = 0; i < list.size(); i++) {
+            if (!runnable(algos[a], list[i])) {
+                continue;
+            }
+            dist_data inst;
+            parse_instance(instance_path(list[i]), inst);
+            bench_result r = measure(algos[a], list[i], false, threads, warmup_count, run_count);
+            all.push_back(r);
+            calibration_sample s = {instance_kind(inst), (double)inst.n,
+                                    r.total.median - r.phases[PHASE_PARSE].median, 0};
+            if (algos[a] == "lk") {
+                s.seconds /= lin_kern::default_runs(inst.n, machine_threads);
+            }
+            if (known_optima.count(r.instance)) {
+                s.excess = r.cost / known_optima[r.instance] - 1;
+            }
+            samples.push_back(s);
+        }
+        if (!samples.empty()) {
+            fit_models(algos[a], samples, threads, profile);
+        }
+    }
+    if (profile.save(path)) {
+        printf("Wrote %s\n", path.c_str());
+    } else {
+        printf("Could not write %s\n", path.c_str());
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    string benchmark = "";
+    vector<string> algos = {"hk", "lk", "gen", "sa", "cluster", "aco"};
+    bool algos_given = false;
+    vector<string> instances;
+    vector<int> threads = {2, 4, 8};
+    bool threads_given = false;
+    string csv_name = "";
+    string json_name = "";
+    bool runs_given = false;
+    bool warmup_given = false;
+    bool update = false;
+    double tolerance = -1;          // no timing check
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-b" && i + 1 < argc) {
+            benchmark = argv[i + 1];
+        } else if (arg == "-a" && i + 1 < argc) {
+            algos = split(argv[i + 1]);
+            for (size_t a = 0; a < algos.size(); a++) {
+                algos[a] = solver_name(algos[a]);
+            }
+            algos_given = true;
+        } else if (arg == "-f" && i + 1 < argc) {
+            instances = split(argv[i + 1]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            vector<string> counts = split(argv[i + 1]);
+            threads.clear();
+            threads_given = true;
+            for (size_t t = 0; t < counts.size(); t++) {
+                threads.push_back(max(1, atoi(counts[t].c_str())));
+            }
+        } else if (arg == "-r" && i + 1 < argc) {
+            run_count = max(1, atoi(argv[i + 1]));
+            runs_given = true;
+        } else if (arg == "-w" && i + 1 < argc) {
+            warmup_count = max(0, atoi(argv[i + 1]));
+            warmup_given = true;
+        } else if (arg == "-seed" && i + 1 < argc) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (arg == "-o" && i + 1 < argc) {
+            csv_name = argv[i + 1];
+        } else if (arg == "-j" && i + 1 < argc) {
+            json_name = argv[i + 1];
+        } else if (arg == "-u") {
+            update = true;
+        } else if (arg == "-tol" && i + 1 < argc) {
+            tolerance = atof(argv[i + 1]);
+        }
+    }
+
+    for (size_t a = 0; a < algos.size(); a++) {
+        if (!instance_dict.count(algos[a])) {
+            cout << "Unknown algorithm " << algos[a] << ", use hk, lk, gen, sa, cluster, aco or bb" << endl;
+            return 0;
+        }
+    }
+    if (benchmark != "" && benchmark != "scale" && benchmark != "eff" && benchmark != "acc" &&
+        benchmark != "regress" && benchmark != "calibrate") {
+        cout << "Unknown benchmark " << benchmark << ", use scale, eff, acc, regress or calibrate" << endl;
+        return 0;
+    }
+    if (threads.empty()) {
+        cout << "Please specify thread counts by adding -t [THREADS]" << endl;
+        return 0;
+    }
+    int max_threads = *max_element(threads.begin(), threads.end());
+
+    vector<bench_result> results;
+    int failed = 0;
+    if (benchmark == "regress") {
+        run_count = runs_given ? run_count : 3;
+        if (!algos_given) {
+            algos.push_back("bb");
+        }
+        failed = run_regress(algos, instances, max_threads, update, tolerance, results);
+    } else if (benchmark == "calibrate") {
+        run_count = runs_given ? run_count : 1;
+        warmup_count = warmup_given ? warmup_count : 0;
+        if (!algos_given) {
+            algos.push_back("bb");
+        }
+        // the model is for this machine, so by default it uses all of its cores
+        run_calibrate(algos, threads_given ? max_threads : machine_threads, results);
+    } else if (benchmark == "scale") {
+        for (size_t a = 0; a < algos.size(); a++) {
+            vector<string> &list = instances.empty() ? instance_dict[algos[a]] : instances;
+            run_scale(algos[a], list, threads, results);
+        }
+    } else if (benchmark == "eff" || benchmark == "acc") {
+        vector<string> &list = instances.empty() ? instance_dict["lk"] : instances;
+        run_table(benchmark, algos, list, instances.empty(), max_threads, results);
+    } else {
+        for (size_t a = 0; a < algos.size(); a++) {
+            vector<string> &list = instances.empty() ? instance_dict[algos[a]] : instances;
+            for (size_t i = 0; i < list.size(); i++) {
+                if (!runnable(algos[a], list[i])) {
+                    continue;
+                }
+                results.push_back(measure(algos[a], list[i], true, 1, warmup_count, run_count));
+                for (size_t t = 0; t < threads.size(); t++) {
+                    results.push_back(measure(algos[a], list[i], false, threads[t], warmup_count, run_count));
+                }
+            }
+        }
+    }
+
+    if (csv_name != "") {
+        write_phase_csv(csv_name, results);
+    }
+    if (json_name != "") {
+        write_phase_json(json_name, results);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,473 @@
+/*  Parallel branch and bound for the symmetric TSP
+    Input: any symmetric instance the parser reads, up to a few hundred cities.
+    Output: The cost of the optimal tour, or with a time limit the best tour
+    found and the proven gap to the optimum.
+    Every search node is a set of fixed and banned edges, bounded from below
+    by a subgradient optimized 1-tree (see common/one_tree.h). A node whose
+    1-tree has a node v of degree above 2 is split on two free tree edges
+    e1, e2 at v (Volgenant and Jonker): ban e1; fix e1 and ban e2; fix both.
+    The search starts from the Lin-Kernighan tour as incumbent, and one thread
+    first dives depth first from the root to a leaf: threads started on a
+    weak incumbent expand nodes the dive's tour would have pruned, which took
+    more nodes in total the more threads there were. Then each thread runs
+    depth first on its own deque and steals the lowest bound node of another
+    thread when it runs dry; the incumbent is shared through an atomic, so a
+    better tour found by one thread prunes the nodes of all of them at once.
+    With a time limit, Lin-Kernighan gets a quarter of it and the subgradient
+    optimization of every node stops at it too.
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "../libtsp/tsp.h"
+#include "../common/one_tree.h"
+#include "../common/perf.h"
+
+using namespace std;
+
+namespace branch_bound {
+
+// Subgradient steps at the root and at every other node, which starts from its parent's penalties
+const int ROOT_ITERS = 1000;
+const int NODE_ITERS = 50;
+// Share of the time limit Lin-Kernighan may spend on the first incumbent
+const double LK_SHARE = 0.25;
+
+/*  One subproblem: the tours that use every fixed edge and no banned one
+    The branching choice is made when the node is bounded, from its 1-tree */
+struct bb_node {
+    double bound;
+    vector<char> state;     // n x n edge states
+    vector<int> fixed;      // the two fixed neighbours of each node, -1 if unused
+    vector<double> pi;
+    int v, a, b;            // split on edges (v, a) and (v, b)
+};
+
+
+// Copies the instance's distances into a dense n x n matrix
+struct dense_weights {
+    int n;
+    vector<double> w;
+    bool integral;
+
+    dense_weights(int n) : n(n), integral(true) {}
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        w.resize((size_t)n * n);
+        integral = true;
+        vector<float> row(n);
+        for (int i = 0; i < n; i++) {
+            dist_row(dist, i, n, row.data());
+            for (int j = 0; j < n; j++) {
+                w[(size_t)i * n + j] = row[j];
+                integral = integral && row[j] == floor(row[j]);
+            }
+        }
+    }
+};
+
+
+// Returns the far end of the fixed path that starts at x, and its node count
+int path_end(const bb_node &node, int x, int &size) {
+    int prev = -1;
+    size = 1;
+    while (true) {
+        const int *f = &node.fixed[2 * x];
+        int next = f[0] >= 0 && f[0] != prev ? f[0] : (f[1] >= 0 && f[1] != prev ? f[1] : -1);
+        if (next < 0) {
+            return x;
+        }
+        prev = x;
+        x = next;
+        size++;
+    }
+}
+
+// Bans edge (u, v), returns false if it is fixed
+bool ban_edge(bb_node &node, int n, int u, int v) {
+    char &s = node.state[(size_t)u * n + v];
+    if (s == EDGE_FIXED) {
+        return false;
+    }
+    s = EDGE_BANNED;
+    node.state[(size_t)v * n + u] = EDGE_BANNED;
+    return true;
+}
+
+/*  Fixes edge (u, v) and bans the edges it rules out: the other edges of a
+    node with two fixed edges, and the edge that would close the fixed path
+    through u and v into a cycle shorter than a tour. When the fixed edges
+    form a path through every node its closing edge is fixed too. Returns
+    false if no tour of the node can use the edge */
+bool fix_edge(bb_node &node, int n, int u, int v) {
+    char s = node.state[(size_t)u * n + v];
+    if (s == EDGE_FIXED) {
+        return true;
+    }
+    if (s == EDGE_BANNED || node.fixed[2 * u + 1] >= 0 || node.fixed[2 * v + 1] >= 0) {
+        return false;
+    }
+    int size_u, size_v;
+    int end_u = path_end(node, u, size_u);
+    int end_v = path_end(node, v, size_v);
+    if (end_u == v && size_u < n) {
+        return false;
+    }
+
+    node.state[(size_t)u * n + v] = EDGE_FIXED;
+    node.state[(size_t)v * n + u] = EDGE_FIXED;
+    node.fixed[2 * u + (node.fixed[2 * u] >= 0)] = v;
+    node.fixed[2 * v + (node.fixed[2 * v] >= 0)] = u;
+    int ends[2] = {u, v};
+    for (int e = 0; e < 2; e++) {
+        int x = ends[e];
+        if (node.fixed[2 * x + 1] < 0) {
+            continue;
+        }
+        for (int y = 0; y < n; y++) {
+            if (node.state[(size_t)x * n + y] == EDGE_FREE) {
+                ban_edge(node, n, x, y);
+            }
+        }
+    }
+    if (end_u == v || size_u + size_v == 2) {
+        return true;
+    }
+    if (size_u + size_v < n) {
+        return node.state[(size_t)end_u * n + end_v] == EDGE_BANNED || ban_edge(node, n, end_u, end_v);
+    }
+    return fix_edge(node, n, end_u, end_v);
+}
+
+
+// Per thread deque of open nodes: the owner works on the back, thieves take the front
+struct work_deque {
+    mutex lock;
+    deque<unique_ptr<bb_node> > nodes;
+};
+
+struct bb_search {
+    int n;
+    const double *w;
+    bool integral;
+    double deadline;                // wall_time() to stop at, 0 for none
+
+    atomic<double> incumbent;
+    mutex tour_lock;
+    vector<int> best_tour;          // visiting order
+
+    vector<work_deque> deques;
+    atomic<long long> open;         // nodes queued or being expanded
+    atomic<long long> nodes;        // nodes bounded
+    atomic<bool> stopped;
+    atomic<double> open_bound;      // lowest bound of the nodes dropped at the deadline
+
+    bb_search(int n, const double *w, bool integral, double deadline, int threads)
+        : n(n), w(w), integral(integral), deadline(deadline), incumbent(DBL_MAX), deques(threads),
+          open(0), nodes(0), stopped(false), open_bound(DBL_MAX) {}
+
+    // Bounds above this cannot lead to a better tour; integral weights give integral tours
+    double cutoff() const {
+        double upper = incumbent.load();
+        return integral ? upper - 1 + 1e-6 : upper - 1e-9 * max(1.0, upper);
+    }
+
+    void improve(const one_tree &t) {
+        vector<int> adj(2 * n, -1);
+        for (int e = 0; e < n; e++) {
+            adj[2 * t.from[e] + (adj[2 * t.from[e]] >= 0)] = t.to[e];
+            adj[2 * t.to[e] + (adj[2 * t.to[e]] >= 0)] = t.from[e];
+        }
+        vector<int> order(n);
+        double cost = 0;
+        for (int i = 0, prev = -1, c = 0; i < n; i++) {
+            order[i] = c;
+            int next = adj[2 * c] != prev ? adj[2 * c] : adj[2 * c + 1];
+            cost += w[(size_t)c * n + next];
+            prev = c;
+            c = next;
+        }
+        lock_guard<mutex> guard(tour_lock);
+        if (cost < incumbent.load()) {
+            best_tour.swap(order);
+            incumbent.store(cost);
+        }
+    }
+
+    static void lower(atomic<double> &x, double value) {
+        double old = x.load();
+        while (value < old && !x.compare_exchange_weak(old, value)) {}
+    }
+
+    /*  Bounds a node and picks its split; returns false if it is pruned
+        or its 1-tree is a tour, which then becomes the incumbent if better */
+    bool evaluate(bb_node &node, int iters, double lambda, one_tree &t) {
+        nodes++;
+        node.bound = subgradient_bound(w, n, node.state.data(), node.pi, incumbent.load(), cutoff(),
+                                       iters, lambda, max(5, iters / 10), t, deadline);
+        if (node.bound == DBL_MAX || node.bound > cutoff()) {
+            return false;
+        }
+        if (t.is_tour()) {
+            improve(t);
+            return false;
+        }
+        // split at the node of highest degree, on its two heaviest free tree edges
+        node.v = -1;
+        for (int i = 0; i < n; i++) {
+            if (t.degree[i] > 2 && (node.v < 0 || t.degree[i] > t.degree[node.v])) {
+                node.v = i;
+            }
+        }
+        node.a = node.b = -1;
+        double wa = -DBL_MAX, wb = -DBL_MAX;
+        for (int e = 0; e < n; e++) {
+            int x = t.from[e] == node.v ? t.to[e] : (t.to[e] == node.v ? t.from[e] : -1);
+            if (x < 0 || node.state[(size_t)node.v * n + x] != EDGE_FREE) {
+                continue;
+            }
+            double c = w[(size_t)node.v * n + x] + node.pi[x];
+            if (c > wa) {
+                node.b = node.a;
+                wb = wa;
+                node.a = x;
+                wa = c;
+            } else if (c > wb) {
+                node.b = x;
+                wb = c;
+            }
+        }
+        return true;
+    }
+
+    // Bounds the children of a node and queues the promising ones, lowest bound on top
+    void expand(const bb_node &node, int tid, one_tree &t) {
+        vector<unique_ptr<bb_node> > children;
+        for (int c = 0; c < 3; c++) {
+            unique_ptr<bb_node> child(new bb_node(node));
+            bool ok = c == 0 ? ban_edge(*child, n, node.v, node.a)
+                             : fix_edge(*child, n, node.v, node.a) &&
+                               (c == 1 ? ban_edge(*child, n, node.v, node.b)
+                                       : fix_edge(*child, n, node.v, node.b));
+            if (ok && evaluate(*child, NODE_ITERS, 0.5, t)) {
+                children.push_back(move(child));
+            }
+        }
+        sort(children.begin(), children.end(),
+             [](const unique_ptr<bb_node> &x, const unique_ptr<bb_node> &y) { return x->bound > y->bound; });
+        open += children.size();
+        lock_guard<mutex> guard(deques[tid].lock);
+        for (size_t c = 0; c < children.size(); c++) {
+            deques[tid].nodes.push_back(move(children[c]));
+        }
+    }
+
+    unique_ptr<bb_node> take(int tid) {
+        unique_ptr<bb_node> node;
+        {
+            lock_guard<mutex> guard(deques[tid].lock);
+            if (!deques[tid].nodes.empty()) {
+                node = move(deques[tid].nodes.back());
+                deques[tid].nodes.pop_back();
+                return node;
+            }
+        }
+        int threads = deques.size();
+        for (int k = 1; k < threads; k++) {
+            work_deque &victim = deques[(tid + k) % threads];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.nodes.empty()) {
+                auto lowest = min_element(victim.nodes.begin(), victim.nodes.end(),
+                                          [](const unique_ptr<bb_node> &x, const unique_ptr<bb_node> &y) {
+                                              return x->bound < y->bound;
+                                          });
+                node = move(*lowest);
+                victim.nodes.erase(lowest);
+                return node;
+            }
+        }
+        return node;
+    }
+
+    /*  Follows the lowest bound child down from the nodes of thread 0 until a
+        node has no child left, queueing the siblings on the way */
+    void dive() {
+        one_tree t;
+        while (!(deadline > 0 && wall_time() > deadline)) {
+            unique_ptr<bb_node> node = take(0);
+            if (!node) {
+                return;
+            }
+            size_t queued = deques[0].nodes.size();
+            if (node->bound <= cutoff()) {
+                expand(*node, 0, t);
+            }
+            open--;
+            if (deques[0].nodes.size() == queued) {
+                return;
+            }
+        }
+    }
+
+    // Work loop of one thread, until no node is left anywhere
+    void work(int tid) {
+        PERF_REGION("bb_search");
+        one_tree t;
+        int idle = 0;
+        while (true) {
+            unique_ptr<bb_node> node = take(tid);
+            if (!node) {
+                if (open.load() == 0) {
+                    return;
+                }
+                // back off so idle thieves leave the cores to the threads with work
+                if (++idle < 16) {
+                    this_thread::yield();
+                } else {
+                    this_thread::sleep_for(chrono::microseconds(100));
+                }
+                continue;
+            }
+            idle = 0;
+            if (!stopped && deadline > 0 && wall_time() > deadline) {
+                stopped = true;
+            }
+            if (stopped) {
+                lower(open_bound, node->bound);
+            } else if (node->bound <= cutoff()) {
+                expand(*node, tid, t);
+            }
+            open--;
+        }
+    }
+};
+
+
+// Returns an optimal tour, or the best found within opts.time_limit
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    int n = inst.n;
+    double start = wall_time();
+    tsp_result result;
+    dense_weights weights(n);
+    dispatch_metric(inst, weights);
+    if (n <= 3) {
+        // every tour is optimal
+        result.cost = 0;
+        for (int i = 0; i < n; i++) {
+            result.tour.push_back(i);
+            result.cost += n > 1 ? weights.w[(size_t)i * n + (i + 1) % n] : 0;
+        }
+        mark_phase(timer, PHASE_SOLVE);
+        return result;
+    }
+    int threads = omp_get_max_threads();
+    bb_search search(n, weights.w.data(), weights.integral,
+                     opts.time_limit > 0 ? start + opts.time_limit : 0, threads);
+    mark_phase(timer, PHASE_ALLOC);
+
+    // Lin-Kernighan's tour is the first incumbent, found in a share of the time limit
+    tsp_options lk_opts = opts;
+    lk_opts.time_limit = opts.time_limit * LK_SHARE;
+    tsp_result lk = lin_kern::solve(inst, lk_opts);
+    search.incumbent = lk.cost;
+    search.best_tour = lk.tour;
+
+    unique_ptr<bb_node> root(new bb_node());
+    root->state.assign((size_t)n * n, EDGE_FREE);
+    for (int i = 0; i < n; i++) {
+        root->state[(size_t)i * n + i] = EDGE_BANNED;
+    }
+    root->fixed.assign(2 * n, -1);
+    root->pi.assign(n, 0);
+    one_tree t;
+    bool branch = search.evaluate(*root, ROOT_ITERS, 2, t);
+    double root_bound = min(root->bound, search.incumbent.load());
+    double search_start = wall_time();
+    if (branch) {
+        search.open = 1;
+        search.deques[0].nodes.push_back(move(root));
+        search.dive();
+        #pragma omp parallel
+        search.work(omp_get_thread_num());
+    }
+    double search_seconds = wall_time() - search_start;
+    mark_phase(timer, PHASE_SOLVE);
+
+    result.cost = search.incumbent.load();
+    result.tour.swap(search.best_tour);
+    normalize_tour(result.tour);
+    double lower = min(search.open_bound.load(), result.cost);
+    if (weights.integral) {
+        lower = min(ceil(lower - 1e-6), result.cost);
+    }
+    // the root is bounded before the search starts
+    long long searched = search.nodes.load() - 1;
+    result.stats.push_back(tsp_stat("nodes", search.nodes.load()));
+    result.stats.push_back(tsp_stat("nodes_per_s", searched > 0 ? searched / search_seconds : 0));
+    result.stats.push_back(tsp_stat("lk_cost", lk.cost));
+    result.stats.push_back(tsp_stat("root_bound", root_bound));
+    result.stats.push_back(tsp_stat("proven_gap", result.cost > 0 ? (result.cost - lower) / result.cost : 0));
+    return result;
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
+int main(int argc, char *argv[]) {
+    string file_name = "";
+    tsp_options opts;
+    int num_threads = omp_get_max_threads();
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            file_name = argv[i + 1];
+        } else if (arg == "-t" && i + 1 < argc) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (arg == "-r" && i + 1 < argc) {
+            opts.runs = atoi(argv[i + 1]);
+        } else if (arg == "-seed" && i + 1 < argc) {
+            opts.seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (arg == "-time" && i + 1 < argc) {
+            opts.time_limit = atof(argv[i + 1]);
+        }
+    }
+
+    if (file_name == "") {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
+    }
+
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
+    if (!is_symmetric(inst)) {
+        cout << "Branch and bound needs a symmetric instance" << endl;
+        return 1;
+    }
+
+    omp_set_num_threads(num_threads);
+    cout << "Running with " << num_threads << " threads" << endl;
+    tsp_result result = branch_bound::solve(inst, opts);
+    for (size_t i = 0; i < result.stats.size(); i++) {
+        cout << result.stats[i].name << " = " << setprecision(12) << result.stats[i].value << endl;
+    }
+
+    // Output optimal cost
+    cout << "Tour cost = " << setprecision(12) << result.cost << endl;
+    return 0;
+}
+#endif
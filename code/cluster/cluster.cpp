@@ -0,0 +1,504 @@
+/*  Cluster decomposition for the symmetric TSP
+    Input: any symmetric instance the parser reads.
+    Output: The cost of the tour found.
+    The cities are grouped around n / MAX_CLUSTER medoids, and groups larger
+    than MAX_CLUSTER are split by recursive bisection: each set is cut
+    between two far apart cities, at the difference of the distances to
+    them. Neither needs coordinates, so any metric works. The
+    clusters are then ordered into a cycle, with the shortest edge between two
+    clusters as their distance (exactly with Held-Karp for a few clusters,
+    with Lin-Kernighan otherwise). A cluster is entered at one of the ENDS
+    cities closest to the previous cluster and left at one of those closest
+    to the next; Held-Karp, one cluster per thread, solves the shortest path
+    through the cluster between every such pair exactly, and a dynamic
+    program around the ring picks the pairs that give the shortest tour.
+    The stitched tour is then polished by Lin-Kernighan starting from it,
+    restarted from double-bridge kicks of the best tour so far. The number of
+    kicks falls with n to bound the polish time, so the small instances end
+    at or within a percent of the optimum while on thousands of cities the
+    solver trades several percent of quality for speed.
+*/
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdlib.h>
+#include <float.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "../libtsp/tsp.h"
+#include "../common/perf.h"
+
+using namespace std;
+
+namespace cluster {
+
+const int MAX_CLUSTER = 16;
+// Largest number of clusters ordered exactly
+const int MAX_EXACT_ORDER = 12;
+// Candidate entry and exit cities of a cluster
+const int ENDS = 3;
+const int MEDOID_ROUNDS = 20;
+// Double-bridge restarts of the Lin-Kernighan polish, fewer on larger instances
+const int MAX_KICKS = 1000;
+const int KICK_CITIES = 100000;
+
+
+/*  Splits cities[lo, hi) into ceil(size / max_size) parts of nearly equal
+    size, appending the [begin, end) range of every part to parts */
+template <class Dist>
+void bisect(const Dist &dist, vector<int> &cities, int lo, int hi, int max_size, vector<pair<int, int> > &parts) {
+    int size = hi - lo;
+    int count = (size + max_size - 1) / max_size;
+    if (count <= 1) {
+        parts.push_back(make_pair(lo, hi));
+        return;
+    }
+    // Two far apart cities: the farthest from the first, then the farthest from that
+    int a = cities[lo], b = a;
+    for (int round = 0; round < 2; round++) {
+        int from = b;
+        float far = -1;
+        for (int i = lo; i < hi; i++) {
+            float d = dist(from, cities[i]);
+            if (d > far) {
+                far = d;
+                b = cities[i];
+            }
+        }
+        if (round == 0) {
+            a = b;
+        }
+    }
+    vector<pair<float, int> > key(size);
+    for (int i = 0; i < size; i++) {
+        int c = cities[lo + i];
+        key[i] = make_pair(dist(c, a) - dist(c, b), c);
+    }
+    int left = (long)size * (count / 2) / count;
+    nth_element(key.begin(), key.begin() + left, key.end());
+    for (int i = 0; i < size; i++) {
+        cities[lo + i] = key[i].second;
+    }
+    bisect(dist, cities, lo, lo + left, max_size, parts);
+    bisect(dist, cities, lo + left, hi, max_size, parts);
+}
+
+
+/*  Groups the cities around k medoids, starting from far apart cities and
+    alternating between assigning every city to its closest medoid and
+    moving every medoid to the member closest to all the others */
+template <class Dist>
+void medoids(const Dist &dist, int n, int k, vector<int> &owner) {
+    vector<int> centre(1, 0);
+    vector<float> near(n, FLT_MAX);
+    for (int c = 1; c < k; c++) {
+        int far = 0;
+        for (int i = 0; i < n; i++) {
+            near[i] = min(near[i], (float)dist(i, centre.back()));
+            if (near[i] > near[far]) {
+                far = i;
+            }
+        }
+        centre.push_back(far);
+    }
+    owner.assign(n, 0);
+    for (int round = 0; round < MEDOID_ROUNDS; round++) {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            float best = FLT_MAX;
+            for (int c = 0; c < k; c++) {
+                float d = dist(i, centre[c]);
+                if (d < best) {
+                    best = d;
+                    owner[i] = c;
+                }
+            }
+        }
+        vector<vector<int> > members(k);
+        for (int i = 0; i < n; i++) {
+            members[owner[i]].push_back(i);
+        }
+        bool moved = false;
+        #pragma omp parallel for schedule(dynamic, 1) reduction(||:moved)
+        for (int c = 0; c < k; c++) {
+            double best = DBL_MAX;
+            int pick = centre[c];
+            for (size_t i = 0; i < members[c].size(); i++) {
+                double sum = 0;
+                for (size_t j = 0; j < members[c].size(); j++) {
+                    sum += dist(members[c][i], members[c][j]);
+                }
+                if (sum < best) {
+                    best = sum;
+                    pick = members[c][i];
+                }
+            }
+            moved = moved || pick != centre[c];
+            centre[c] = pick;
+        }
+        if (!moved) {
+            break;
+        }
+    }
+}
+
+
+// Copies the distances among cities into an explicit matrix instance
+template <class Dist>
+void sub_instance(const Dist &dist, const vector<int> &cities, dist_data &sub) {
+    int c = cities.size();
+    sub.metric = METRIC_MATRIX;
+    sub.n = c;
+    sub.W.resize((size_t)c * c);
+    for (int i = 0; i < c; i++) {
+        for (int j = 0; j < c; j++) {
+            sub.W[(size_t)i * c + j] = i == j ? 0 : dist(cities[i], cities[j]);
+        }
+    }
+    sub.sync_views();
+}
+
+
+// The k cities of 'to' closest to any city of 'from'
+template <class Dist>
+vector<int> closest_to(const Dist &dist, const vector<int> &from, const vector<int> &to, int k) {
+    vector<pair<float, int> > near(to.size());
+    for (size_t j = 0; j < to.size(); j++) {
+        float d = FLT_MAX;
+        for (size_t i = 0; i < from.size(); i++) {
+            d = min(d, (float)dist(from[i], to[j]));
+        }
+        near[j] = make_pair(d, to[j]);
+    }
+    k = min(k, (int)near.size());
+    partial_sort(near.begin(), near.begin() + k, near.end());
+    vector<int> cities(k);
+    for (int i = 0; i < k; i++) {
+        cities[i] = near[i].second;
+    }
+    return cities;
+}
+
+
+/*  Ways through one cluster: option o enters at entries[o / exits.size()]
+    and leaves at exits[o % exits.size()] along the shortest path between
+    them, which Held-Karp solves exactly (length FLT_MAX if the two are the
+    same city, unless it is the only one) */
+struct crossing {
+    vector<int> entries;
+    vector<int> exits;
+    vector<float> length;
+    vector<vector<int> > path;
+
+    template <class Dist>
+    void solve(const Dist &dist, const vector<int> &cities) {
+        int c = cities.size();
+        length.assign(entries.size() * exits.size(), FLT_MAX);
+        path.resize(length.size());
+        if (c == 1) {
+            length[0] = 0;
+            path[0] = cities;
+            return;
+        }
+        for (size_t e = 0; e < entries.size(); e++) {
+            // Held-Karp's paths start at local city 0
+            vector<int> local = cities;
+            swap(local[0], *find(local.begin(), local.end(), entries[e]));
+            dist_data sub;
+            sub_instance(dist, local, sub);
+            vector<float> ends;
+            vector<vector<int> > walks;
+            held_karp_par::open_paths(sub, ends, walks);
+            for (size_t x = 0; x < exits.size(); x++) {
+                int k = find(local.begin(), local.end(), exits[x]) - local.begin();
+                if (k == 0) {
+                    continue;
+                }
+                size_t o = e * exits.size() + x;
+                length[o] = ends[k];
+                path[o].resize(c);
+                for (int i = 0; i < c; i++) {
+                    path[o][i] = local[walks[k][i]];
+                }
+            }
+        }
+    }
+
+    int entry(int o) const {
+        return entries[o / exits.size()];
+    }
+
+    int exit(int o) const {
+        return exits[o % exits.size()];
+    }
+};
+
+
+/*  Dynamic program around the ring of clusters with the option of the first
+    cluster fixed: f[o] is the shortest way from that option through option
+    o of the current cluster. Returns the length of the closed tour, and
+    fills parent[s][o] with the option taken in cluster s - 1 if given */
+template <class Dist>
+double ring_pass(const Dist &dist, const vector<crossing> &ring, int first, vector<vector<int> > *parent) {
+    int m = ring.size();
+    vector<double> f(ring[0].length.size(), DBL_MAX), g;
+    f[first] = ring[0].length[first];
+    for (int s = 1; s < m; s++) {
+        const crossing &prev = ring[s - 1], &cur = ring[s];
+        g.assign(cur.length.size(), DBL_MAX);
+        if (parent) {
+            (*parent)[s].assign(g.size(), 0);
+        }
+        for (size_t o = 0; o < g.size(); o++) {
+            if (cur.length[o] == FLT_MAX) {
+                continue;
+            }
+            for (size_t i = 0; i < f.size(); i++) {
+                if (f[i] == DBL_MAX) {
+                    continue;
+                }
+                double cost = f[i] + dist(prev.exit(i), cur.entry(o)) + cur.length[o];
+                if (cost < g[o]) {
+                    g[o] = cost;
+                    if (parent) {
+                        (*parent)[s][o] = i;
+                    }
+                }
+            }
+        }
+        f.swap(g);
+    }
+    double best = DBL_MAX;
+    for (size_t i = 0; i < f.size(); i++) {
+        if (f[i] == DBL_MAX) {
+            continue;
+        }
+        double cost = f[i] + dist(ring[m - 1].exit(i), ring[0].entry(first));
+        if (cost < best) {
+            best = cost;
+            if (parent) {
+                (*parent)[0].assign(1, i);
+            }
+        }
+    }
+    return best;
+}
+
+
+struct decomposition {
+    int n;
+    int max_size;
+    unsigned long long seed;
+    int clusters;
+    double stitched_cost;
+    vector<int> order;
+
+    decomposition(int n, int max_size, unsigned long long seed)
+        : n(n), max_size(max_size), seed(seed), clusters(0), stitched_cost(0) {}
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        /*  Medoid clusters follow the clusters of the instance, those that
+            come out too large are bisected */
+        vector<int> cities(n);
+        vector<pair<int, int> > parts;
+        if (n > max_size) {
+            int k = (n + max_size - 1) / max_size;
+            vector<int> group;
+            medoids(dist, n, k, group);
+            vector<int> start(k + 1, 0);
+            for (int i = 0; i < n; i++) {
+                start[group[i] + 1]++;
+            }
+            for (int c = 0; c < k; c++) {
+                start[c + 1] += start[c];
+            }
+            vector<int> fill(start.begin(), start.end() - 1);
+            for (int i = 0; i < n; i++) {
+                cities[fill[group[i]]++] = i;
+            }
+            for (int c = 0; c < k; c++) {
+                if (start[c + 1] > start[c]) {
+                    bisect(dist, cities, start[c], start[c + 1], max_size, parts);
+                }
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                cities[i] = i;
+            }
+            parts.push_back(make_pair(0, n));
+        }
+        int m = parts.size();
+        clusters = m;
+        if (m == 1) {
+            // a single cluster is solved as a cycle
+            dist_data sub;
+            sub_instance(dist, cities, sub);
+            tsp_result r = held_karp_par::solve(sub, tsp_options());
+            order.resize(n);
+            for (int i = 0; i < n; i++) {
+                order[i] = cities[r.tour[i]];
+            }
+            stitched_cost = r.cost;
+            return;
+        }
+        vector<int> owner(n);
+        vector<vector<int> > members(m);
+        for (int p = 0; p < m; p++) {
+            members[p].assign(cities.begin() + parts[p].first, cities.begin() + parts[p].second);
+            for (size_t i = 0; i < members[p].size(); i++) {
+                owner[members[p][i]] = p;
+            }
+        }
+
+        // Order the clusters, their distance is the shortest edge between them
+        vector<int> cycle(m);
+        for (int p = 0; p < m; p++) {
+            cycle[p] = p;
+        }
+        if (m > 3) {
+            dist_data between;
+            between.metric = METRIC_MATRIX;
+            between.n = m;
+            between.W.assign((size_t)m * m, FLT_MAX);
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int p = 0; p < m; p++) {
+                between.W[(size_t)p * m + p] = 0;
+                for (size_t i = 0; i < members[p].size(); i++) {
+                    for (int j = 0; j < n; j++) {
+                        int q = owner[j];
+                        if (q != p) {
+                            float &w = between.W[(size_t)p * m + q];
+                            w = min(w, (float)dist(members[p][i], j));
+                        }
+                    }
+                }
+            }
+            between.sync_views();
+            tsp_options opts;
+            opts.seed = seed;
+            tsp_result r = m <= MAX_EXACT_ORDER ? held_karp_par::solve(between, opts)
+                                                : lin_kern::solve(between, opts);
+            cycle = r.tour;
+        }
+
+        // Exact paths through the clusters in ring order, one cluster per thread
+        vector<crossing> ring(m);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int s = 0; s < m; s++) {
+            PERF_REGION("cluster_paths");
+            const vector<int> &prev = members[cycle[(s + m - 1) % m]];
+            const vector<int> &next = members[cycle[(s + 1) % m]];
+            const vector<int> &own = members[cycle[s]];
+            ring[s].entries = closest_to(dist, prev, own, ENDS);
+            ring[s].exits = closest_to(dist, next, own, ENDS);
+            ring[s].solve(dist, own);
+        }
+
+        int first = 0;
+        double best = DBL_MAX;
+        for (size_t o = 0; o < ring[0].length.size(); o++) {
+            double cost = ring[0].length[o] == FLT_MAX ? DBL_MAX : ring_pass(dist, ring, o, NULL);
+            if (cost < best) {
+                best = cost;
+                first = o;
+            }
+        }
+        vector<vector<int> > parent(m);
+        ring_pass(dist, ring, first, &parent);
+        vector<int> pick(m);
+        pick[0] = first;
+        int o = parent[0][0];
+        for (int s = m - 1; s > 0; s--) {
+            pick[s] = o;
+            o = parent[s][o];
+        }
+
+        order.clear();
+        for (int s = 0; s < m; s++) {
+            const vector<int> &path = ring[s].path[pick[s]];
+            order.insert(order.end(), path.begin(), path.end());
+        }
+        stitched_cost = tour_length_order(dist, order.data(), n);
+    }
+};
+
+
+// Returns the polished tour of the decomposition into clusters of at most max_size cities
+tsp_result decompose(const dist_data &inst, const tsp_options &opts, int max_size, phase_timer *timer) {
+    double deadline = opts.time_limit > 0 ? wall_time() + opts.time_limit : 0;
+    int kicks = max(1, min(MAX_KICKS, KICK_CITIES / inst.n));
+    decomposition split(inst.n, max_size, opts.seed);
+    dispatch_metric(inst, split);
+
+    tsp_result result;
+    result.tour.swap(split.order);
+    result.cost = inst.n > 3 ? lin_kern::improve(inst, result.tour, kicks, opts.seed, deadline)
+                             : split.stitched_cost;
+    if (opts.monitor) {
+        opts.monitor->offer_upper(result.cost);
+    }
+    normalize_tour(result.tour);
+    mark_phase(timer, PHASE_SOLVE);
+
+    result.stats.push_back(tsp_stat("clusters", split.clusters));
+    result.stats.push_back(tsp_stat("stitched_cost", split.stitched_cost));
+    return result;
+}
+
+
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    return decompose(inst, opts, MAX_CLUSTER, timer);
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
+int main(int argc, char *argv[]) {
+    string file_name = "";
+    tsp_options opts;
+    int num_threads = omp_get_max_threads();
+    int max_size = cluster::MAX_CLUSTER;
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            file_name = argv[i + 1];
+        } else if (arg == "-t" && i + 1 < argc) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (arg == "-c" && i + 1 < argc) {
+            max_size = atoi(argv[i + 1]);
+        } else if (arg == "-seed" && i + 1 < argc) {
+            opts.seed = strtoull(argv[i + 1], NULL, 10);
+        }
+    }
+
+    if (file_name == "") {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
+    }
+    if (max_size < 1 || max_size > 24) {
+        cout << "Clusters take 1 to 24 cities" << endl;
+        return 1;
+    }
+
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
+    if (!is_symmetric(inst)) {
+        cout << "Cluster decomposition needs a symmetric instance" << endl;
+        return 1;
+    }
+
+    omp_set_num_threads(num_threads);
+    cout << "Running with " << num_threads << " threads" << endl;
+
+    tsp_result result = cluster::decompose(inst, opts, max_size, NULL);
+    for (size_t i = 0; i < result.stats.size(); i++) {
+        cout << result.stats[i].name << " = " << setprecision(12) << result.stats[i].value << endl;
+    }
+    cout << "Tour cost = " << setprecision(12) << result.cost << endl;
+    return 0;
+}
+#endif
@@ -0,0 +1,420 @@
+/*  Distance oracle shared by all solvers
+    Each TSPLIB metric gets its own oracle type, and solvers are written as
+    templates over the oracle, so the metric is fixed at compile time and the
+    hot loops never branch on the instance type. dispatch_metric() picks the
+    instantiation once per run.
+*/
+#ifndef DIST_H
+#define DIST_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include "simd_dist.h"
+
+// Largest coordinate instance whose rounded distances are precomputed into a table
+#ifndef DIST_TABLE_MAX_N
+#define DIST_TABLE_MAX_N 5000
+#endif
+
+enum metric_type {
+    METRIC_MATRIX,  // explicit weights
+    METRIC_EUC_2D,
+    METRIC_CEIL_2D,
+    METRIC_ATT,
+    METRIC_GEO      // X and Y hold latitude and longitude in radians
+};
+
+/*  Layout of a precomputed distance table
+    Symmetric tables keep only the lower triangle, integral weights are stored
+    in the narrowest integer type that holds the largest weight */
+enum table_layout {
+    TABLE_NONE,
+    TABLE_FULL_U16,
+    TABLE_FULL_I32,
+    TABLE_PACKED_U16,
+    TABLE_PACKED_I32,
+    TABLE_PACKED_F32
+};
+
+/*  Everything needed to evaluate distances of one instance
+    The oracles read through the w, x, y, cand and q views, which point either
+    at the vectors below or into a mapped binary instance kept alive by mapping */
+struct dist_data {
+    metric_type metric;
+    int n;
+    const float *w;     // n x n row-major weights, always set for METRIC_MATRIX
+    const float *x;
+    const float *y;
+    const int *cand;    // k nearest neighbours of each node, row-major n x k
+    int k;
+    std::vector<float> W, X, Y;
+    std::vector<int> C;
+    table_layout table; // layout of the precomputed distances q, if any
+    const void *q;
+    std::vector<unsigned char> Q;
+    std::shared_ptr<const void> mapping;
+
+    dist_data() : metric(METRIC_MATRIX), n(0), w(NULL), x(NULL), y(NULL), cand(NULL), k(0),
+                  table(TABLE_NONE), q(NULL) {}
+
+    // Points the views at the owned vectors that are filled
+    void sync_views() {
+        if (!W.empty()) w = W.data();
+        if (!X.empty()) x = X.data();
+        if (!Y.empty()) y = Y.data();
+        if (!C.empty()) cand = C.data();
+        if (!Q.empty()) q = Q.data();
+    }
+};
+
+// Row-major n x n weight matrix of element type Weight
+template <typename Weight>
+struct matrix_dist {
+    const Weight *w;
+    int n;
+
+    matrix_dist(const Weight *w, int n) : w(w), n(n) {}
+
+    float operator()(int i, int j) const {
+        return w[(size_t)i * n + j];
+    }
+};
+
+/*  Lower triangle (with diagonal) of a symmetric matrix, row a starting at
+    a * (a + 1) / 2. The row and column are ordered with a sign mask instead
+    of a branch, since the comparison is unpredictable in local search */
+template <typename Weight>
+struct packed_dist {
+    const Weight *w;
+
+    packed_dist(const Weight *w) : w(w) {}
+
+    static size_t index(int i, int j) {
+        int d = i - j;
+        int m = d >> 31;        // -1 if i < j, 0 otherwise
+        size_t hi = i - (d & m);
+        size_t lo = j + (d & m);
+        return (hi * (hi + 1) >> 1) + lo;
+    }
+
+    float operator()(int i, int j) const {
+        return w[index(i, j)];
+    }
+};
+
+// Coordinate metric M, rounded exactly as in the TSPLIB specification
+template <metric_type M>
+struct coord_dist {
+    const float *x;
+    const float *y;
+
+    coord_dist(const float *x, const float *y) : x(x), y(y) {}
+
+    float operator()(int i, int j) const {
+        if (M == METRIC_GEO) {
+            const double RRR = 6378.388;
+            double q1 = cos(y[i] - y[j]);
+            double q2 = cos(x[i] - x[j]);
+            double q3 = cos(x[i] + x[j]);
+            return (int)(RRR * acos(0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3)) + 1.0);
+        }
+        double dx = (double)x[i] - x[j];
+        double dy = (double)y[i] - y[j];
+        if (M == METRIC_ATT) {
+            double r = sqrt((dx * dx + dy * dy) / 10.0);
+            int t = (int)(r + 0.5);
+            return t < r ? t + 1 : t;
+        } else if (M == METRIC_CEIL_2D) {
+            return ceil(sqrt(dx * dx + dy * dy));
+        } else {
+            return euc_2d(dx, dy);
+        }
+    }
+};
+
+/*  Batch evaluation over an oracle
+    The generic versions loop over the oracle, the EUC_2D overloads use the
+    vectorized kernels of simd_dist.h */
+
+// out[j] = dist(i, j) for j in [0, count)
+template <class Dist>
+void dist_row(const Dist &dist, int i, int count, float *out) {
+    for (int j = 0; j < count; j++) {
+        out[j] = dist(i, j);
+    }
+}
+
+inline void dist_row(const coord_dist<METRIC_EUC_2D> &dist, int i, int count, float *out) {
+    euc_2d_row(dist.x, dist.y, dist.x[i], dist.y[i], count, out);
+}
+
+// Length of a tour given as successors, city i is followed by next[i]
+template <class Dist>
+double tour_length_next(const Dist &dist, const int *next, int n) {
+    double length = 0;
+    for (int i = 0; i < n; i++) {
+        length += dist(i, next[i]);
+    }
+    return length;
+}
+
+inline double tour_length_next(const coord_dist<METRIC_EUC_2D> &dist, const int *next, int n) {
+    return euc_2d_next_length(dist.x, dist.y, next, n);
+}
+
+// Length of a tour given as the order cities are visited in
+template <class Dist>
+double tour_length_order(const Dist &dist, const int *order, int n) {
+    double length = 0;
+    for (int k = 0; k < n; k++) {
+        length += dist(order[k], order[k + 1 == n ? 0 : k + 1]);
+    }
+    return length;
+}
+
+inline double tour_length_order(const coord_dist<METRIC_EUC_2D> &dist, const int *order, int n) {
+    return euc_2d_order_length(dist.x, dist.y, order, n);
+}
+
+// Returns the number of entries of a packed n x n symmetric table
+inline size_t packed_size(int n) {
+    return (size_t)n * (n + 1) / 2;
+}
+
+// Returns the bytes of a table of layout t for n nodes
+inline size_t table_bytes(table_layout t, int n) {
+    bool packed = t == TABLE_PACKED_U16 || t == TABLE_PACKED_I32 || t == TABLE_PACKED_F32;
+    size_t entries = packed ? packed_size(n) : (size_t)n * n;
+    return entries * (t == TABLE_FULL_U16 || t == TABLE_PACKED_U16 ? sizeof(uint16_t) : sizeof(int32_t));
+}
+
+// Stores the integral weights v in Q as uint16_t if [low, top] fits, int32_t otherwise
+inline table_layout narrow_table(dist_data &data, const std::vector<int32_t> &v, int32_t low, int32_t top, bool packed) {
+    if (low >= 0 && top <= 0xffff) {
+        data.Q.resize(v.size() * sizeof(uint16_t));
+        uint16_t *q = (uint16_t *)data.Q.data();
+        #pragma omp parallel for schedule(static)
+        for (size_t e = 0; e < v.size(); e++) {
+            q[e] = v[e];
+        }
+        data.sync_views();
+        return packed ? TABLE_PACKED_U16 : TABLE_FULL_U16;
+    }
+    data.Q.resize(v.size() * sizeof(int32_t));
+    std::copy(v.begin(), v.end(), (int32_t *)data.Q.data());
+    data.sync_views();
+    return packed ? TABLE_PACKED_I32 : TABLE_FULL_I32;
+}
+
+// Fills data's packed table with every distance of coordinate metric M
+template <metric_type M>
+void fill_dist_table(dist_data &data) {
+    int n = data.n;
+    coord_dist<M> d(data.x, data.y);
+    std::vector<int32_t> v(packed_size(n));
+    int32_t top = 0;
+    #pragma omp parallel reduction(max:top)
+    {
+        std::vector<float> w(n);
+        #pragma omp for schedule(dynamic, 16)
+        for (int i = 0; i < n; i++) {
+            int32_t *row = &v[packed_size(i)];
+            dist_row(d, i, i + 1, w.data());
+            for (int j = 0; j <= i; j++) {
+                row[j] = w[j];
+                top = std::max(top, row[j]);
+            }
+        }
+    }
+    data.table = narrow_table(data, v, 0, top, true);
+}
+
+/*  Packs the explicit matrix data.w: the lower triangle if it is symmetric,
+    quantized to integers if every weight is integral. An owned W is released
+    afterwards since the table replaces it */
+inline void pack_matrix(dist_data &data) {
+    int n = data.n;
+    const float *w = data.w;
+    bool symmetric = true, integral = true;
+    float low = 0, top = 0;
+    #pragma omp parallel for schedule(dynamic, 16) reduction(&&:symmetric, integral) reduction(min:low) reduction(max:top)
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            float x = w[(size_t)i * n + j];
+            symmetric = symmetric && (j > i || x == w[(size_t)j * n + i]);
+            // the cast is only defined for values int32_t holds, which NaN is not
+            integral = integral && fabsf(x) < 2147483648.0f && x == (int32_t)x;
+            low = std::min(low, x);
+            top = std::max(top, x);
+        }
+    }
+    if (!integral && !symmetric) {
+        return;
+    }
+    size_t size = symmetric ? packed_size(n) : (size_t)n * n;
+    if (integral) {
+        std::vector<int32_t> v(size);
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int i = 0; i < n; i++) {
+            int cols = symmetric ? i + 1 : n;
+            size_t start = symmetric ? packed_size(i) : (size_t)i * n;
+            for (int j = 0; j < cols; j++) {
+                v[start + j] = w[(size_t)i * n + j];
+            }
+        }
+        data.table = narrow_table(data, v, low, top, symmetric);
+    } else if (symmetric) {
+        data.Q.resize(size * sizeof(float));
+        float *q = (float *)data.Q.data();
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int i = 0; i < n; i++) {
+            std::copy(w + (size_t)i * n, w + (size_t)i * n + i + 1, q + packed_size(i));
+        }
+        data.sync_views();
+        data.table = TABLE_PACKED_F32;
+    } else {
+        return;
+    }
+    if (!data.W.empty()) {
+        std::vector<float>().swap(data.W);
+        data.w = NULL;
+    }
+}
+
+// True if every weight of data equals its reverse
+inline bool is_symmetric(const dist_data &data) {
+    switch (data.table) {
+        case TABLE_PACKED_U16: case TABLE_PACKED_I32: case TABLE_PACKED_F32: return true;
+        // pack_matrix keeps full tables only for asymmetric matrices
+        case TABLE_FULL_U16: case TABLE_FULL_I32: return false;
+        default: break;
+    }
+    if (!data.w) {
+        return true;
+    }
+    for (int i = 0; i < data.n; i++) {
+        for (int j = 0; j < i; j++) {
+            if (data.w[(size_t)i * data.n + j] != data.w[(size_t)j * data.n + i]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*  Precomputes the distance table of data: explicit matrices are always
+    packed, coordinate instances only up to max_n nodes */
+inline void precompute_dist_table(dist_data &data, int max_n = DIST_TABLE_MAX_N) {
+    if (data.table != TABLE_NONE) {
+        return;
+    }
+    if (data.w) {
+        pack_matrix(data);
+        return;
+    }
+    if (data.n > max_n) {
+        return;
+    }
+    switch (data.metric) {
+        case METRIC_CEIL_2D: fill_dist_table<METRIC_CEIL_2D>(data); break;
+        case METRIC_ATT: fill_dist_table<METRIC_ATT>(data); break;
+        case METRIC_GEO: fill_dist_table<METRIC_GEO>(data); break;
+        default: fill_dist_table<METRIC_EUC_2D>(data); break;
+    }
+}
+
+/*  Calls fn(d) with the oracle d matching data, so fn's templated operator()
+    is instantiated once per metric. Results are returned through fn's members */
+template <class Fn>
+void dispatch_metric(const dist_data &data, Fn &fn) {
+    const void *q = data.q;
+    switch (data.table) {
+        case TABLE_FULL_U16: fn(matrix_dist<uint16_t>((const uint16_t *)q, data.n)); return;
+        case TABLE_FULL_I32: fn(matrix_dist<int32_t>((const int32_t *)q, data.n)); return;
+        case TABLE_PACKED_U16: fn(packed_dist<uint16_t>((const uint16_t *)q)); return;
+        case TABLE_PACKED_I32: fn(packed_dist<int32_t>((const int32_t *)q)); return;
+        case TABLE_PACKED_F32: fn(packed_dist<float>((const float *)q)); return;
+        default: break;
+    }
+    if (data.w) {
+        fn(matrix_dist<float>(data.w, data.n));
+        return;
+    }
+    switch (data.metric) {
+        case METRIC_CEIL_2D: fn(coord_dist<METRIC_CEIL_2D>(data.x, data.y)); break;
+        case METRIC_ATT: fn(coord_dist<METRIC_ATT>(data.x, data.y)); break;
+        case METRIC_GEO: fn(coord_dist<METRIC_GEO>(data.x, data.y)); break;
+        default: fn(coord_dist<METRIC_EUC_2D>(data.x, data.y)); break;
+    }
+}
+
+
+// Fills each row of cand with the k nodes closest to that row's node
+struct candidate_builder {
+    int n;
+    int k;
+    int *cand;
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        #pragma omp parallel
+        {
+            std::vector<std::pair<float, int> > row(n - 1);
+            std::vector<float> w(n);
+            #pragma omp for schedule(dynamic, 16)
+            for (int i = 0; i < n; i++) {
+                dist_row(dist, i, n, w.data());
+                int m = 0;
+                for (int j = 0; j < n; j++) {
+                    if (j != i) {
+                        row[m++] = std::make_pair(w[j], j);
+                    }
+                }
+                std::partial_sort(row.begin(), row.begin() + k, row.end());
+                for (int c = 0; c < k; c++) {
+                    cand[(size_t)i * k + c] = row[c].second;
+                }
+            }
+        }
+    }
+};
+
+// Computes the k nearest neighbour candidate lists of data into data.C
+inline void compute_candidates(dist_data &data, int k) {
+    k = std::min(k, data.n - 1);
+    data.C.resize((size_t)data.n * k);
+    data.k = k;
+    candidate_builder builder = {data.n, k, data.C.data()};
+    dispatch_metric(data, builder);
+    data.cand = data.C.data();
+}
+
+
+// Fills w with the full row-major n x n matrix of an oracle
+struct matrix_builder {
+    int n;
+    float *w;
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int i = 0; i < n; i++) {
+            dist_row(dist, i, n, w + (size_t)i * n);
+        }
+    }
+};
+
+// Expands the distances of data into the explicit matrix data.W
+inline void expand_dist_matrix(dist_data &data) {
+    std::vector<float> W((size_t)data.n * data.n);
+    matrix_builder builder = {data.n, W.data()};
+    dispatch_metric(data, builder);
+    data.W.swap(W);
+    data.w = data.W.data();
+}
+
+#endif
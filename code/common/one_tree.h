@@ -0,0 +1,408 @@
+/*  Minimum 1-trees and Held-Karp subgradient lower bounds
+    A 1-tree is a spanning tree on nodes 1..n-1 plus two edges at node 0.
+    Every tour is a 1-tree, so for any node penalties pi the lightest 1-tree
+    under the weights w(i,j) + pi[i] + pi[j], minus 2 * sum(pi), is a lower
+    bound on the optimal tour. Subgradient steps move pi towards 1-trees in
+    which every node has degree 2; such a 1-tree is an optimal tour. Edges can
+    be fixed into or banned from the 1-tree, which is how branch and bound
+    splits the tours of a search node; those 1-trees take a dense symmetric
+    n x n weight matrix. Without edge states the complete graph can also be
+    read through a distance oracle, and a sparse candidate graph gives cheap
+    1-trees that are only bounds of tours within that graph, for choosing
+    subgradient directions on large instances.
+*/
+#ifndef ONE_TREE_H
+#define ONE_TREE_H
+
+#include <vector>
+#include <algorithm>
+#include <float.h>
+#include <omp.h>
+#include "timing.h"
+
+enum edge_state {
+    EDGE_FREE,
+    EDGE_FIXED,     // every tour of the node uses the edge
+    EDGE_BANNED     // no tour of the node uses it
+};
+
+// A 1-tree and the scratch space to build it
+struct one_tree {
+    std::vector<int> from, to;  // its n edges
+    std::vector<int> degree;
+    double bound;               // penalized length minus 2 * sum(pi)
+
+    std::vector<double> key;
+    std::vector<int> link, heap, pos;
+    std::vector<char> key_fixed, done;
+
+    // True if every node has degree 2, so the 1-tree is a tour
+    bool is_tour() const {
+        for (size_t i = 0; i < degree.size(); i++) {
+            if (degree[i] != 2) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Sums the degrees of the n edges of t and sets its bound from its penalized length
+inline void finish_one_tree(one_tree &t, int n, double length, const double *pi) {
+    double sum = 0;
+    t.degree.assign(n, 0);
+    for (int i = 0; i < n; i++) {
+        t.degree[t.from[i]]++;
+        t.degree[t.to[i]]++;
+        sum += pi[i];
+    }
+    t.bound = length - 2 * sum;
+}
+
+/*  Builds the lightest 1-tree of w under penalties pi that contains every
+    fixed edge and no banned one, with Prim's algorithm on nodes 1..n-1.
+    Fixed edges win over any free edge, which is the same as giving them a
+    weight below all others. Returns false if the banned edges leave none */
+inline bool min_one_tree(const double *w, int n, const char *state, const double *pi, one_tree &t) {
+    t.from.resize(n);
+    t.to.resize(n);
+    t.key.assign(n, DBL_MAX);
+    t.link.assign(n, -1);
+    t.key_fixed.assign(n, 0);
+    t.done.assign(n, 0);
+
+    double length = 0;
+    int edges = 0;
+    int u = 1;
+    t.done[1] = 1;
+    for (int step = 2; step < n; step++) {
+        const double *row = w + (size_t)u * n;
+        const char *states = state + (size_t)u * n;
+        for (int v = 1; v < n; v++) {
+            if (t.done[v] || states[v] == EDGE_BANNED) {
+                continue;
+            }
+            double c = row[v] + pi[u] + pi[v];
+            char f = states[v] == EDGE_FIXED;
+            if (f > t.key_fixed[v] || (f == t.key_fixed[v] && c < t.key[v])) {
+                t.key[v] = c;
+                t.key_fixed[v] = f;
+                t.link[v] = u;
+            }
+        }
+        int best = -1;
+        for (int v = 1; v < n; v++) {
+            if (!t.done[v] && t.link[v] >= 0 &&
+                (best < 0 || t.key_fixed[v] > t.key_fixed[best] ||
+                 (t.key_fixed[v] == t.key_fixed[best] && t.key[v] < t.key[best]))) {
+                best = v;
+            }
+        }
+        if (best < 0) {
+            return false;
+        }
+        t.done[best] = 1;
+        t.from[edges] = t.link[best];
+        t.to[edges++] = best;
+        length += t.key[best];
+        u = best;
+    }
+
+    // The two edges at node 0: fixed ones first, then the lightest free ones
+    const char *states = state;
+    for (int pick = 0; pick < 2; pick++) {
+        int best = -1;
+        bool best_fixed = false;
+        double best_cost = DBL_MAX;
+        for (int v = 1; v < n; v++) {
+            if (states[v] == EDGE_BANNED || (pick == 1 && v == t.to[edges - 1])) {
+                continue;
+            }
+            bool f = states[v] == EDGE_FIXED;
+            double c = w[v] + pi[0] + pi[v];
+            if (best < 0 || (f && !best_fixed) || (f == best_fixed && c < best_cost)) {
+                best = v;
+                best_fixed = f;
+                best_cost = c;
+            }
+        }
+        if (best < 0) {
+            return false;
+        }
+        t.from[edges] = 0;
+        t.to[edges++] = best;
+        length += best_cost;
+    }
+
+    finish_one_tree(t, n, length, pi);
+    return true;
+}
+
+/*  Lightest 1-tree of the complete graph read through a distance oracle
+    Prim's algorithm in O(n^2); each step's relaxation is split across the
+    OpenMP threads once n is large enough to pay for it */
+template <class Dist>
+void min_one_tree(const Dist &dist, int n, const double *pi, one_tree &t) {
+    t.from.resize(n);
+    t.to.resize(n);
+    t.key.assign(n, DBL_MAX);
+    t.link.assign(n, -1);
+    t.done.assign(n, 0);
+    double length = 0;
+    int threads = n >= 1000 ? omp_get_max_threads() : 1;
+    std::vector<double> thread_key(threads);
+    std::vector<int> thread_best(threads);
+
+    int u = 1;
+    t.done[0] = t.done[1] = 1;
+    for (int edges = 0; edges < n - 2; edges++) {
+        #pragma omp parallel num_threads(threads)
+        {
+            int id = omp_get_thread_num();
+            double best_key = DBL_MAX;
+            int best = -1;
+            #pragma omp for schedule(static)
+            for (int v = 2; v < n; v++) {
+                if (t.done[v]) {
+                    continue;
+                }
+                double c = dist(u, v) + pi[u] + pi[v];
+                if (c < t.key[v]) {
+                    t.key[v] = c;
+                    t.link[v] = u;
+                }
+                if (t.key[v] < best_key) {
+                    best_key = t.key[v];
+                    best = v;
+                }
+            }
+            thread_key[id] = best_key;
+            thread_best[id] = best;
+        }
+        int best = -1;
+        for (int id = 0; id < threads; id++) {
+            if (thread_best[id] >= 0 && (best < 0 || thread_key[id] < t.key[best])) {
+                best = thread_best[id];
+            }
+        }
+        t.done[best] = 1;
+        t.from[edges] = t.link[best];
+        t.to[edges] = best;
+        length += t.key[best];
+        u = best;
+    }
+
+    // the two lightest edges at node 0
+    int first = -1, second = -1;
+    double c1 = DBL_MAX, c2 = DBL_MAX;
+    for (int v = 1; v < n; v++) {
+        double c = dist(0, v) + pi[0] + pi[v];
+        if (c < c1) {
+            second = first;
+            c2 = c1;
+            first = v;
+            c1 = c;
+        } else if (c < c2) {
+            second = v;
+            c2 = c;
+        }
+    }
+    t.from[n - 2] = t.from[n - 1] = 0;
+    t.to[n - 2] = first;
+    t.to[n - 1] = second;
+    finish_one_tree(t, n, length + c1 + c2, pi);
+}
+
+/*  Undirected candidate graph in compressed rows: the neighbours of node i
+    are adj[start[i]] .. adj[start[i + 1] - 1], with edge weights in weight */
+struct sparse_graph {
+    std::vector<std::vector<int> > lists;
+    std::vector<int> start;
+    std::vector<int> adj;
+    std::vector<double> weight;
+
+    // Symmetrizes the k nearest neighbour lists cand (row-major n x k)
+    void init(int n, const int *cand, int k) {
+        lists.assign(n, std::vector<int>());
+        for (int i = 0; i < n; i++) {
+            for (int c = 0; c < k; c++) {
+                lists[i].push_back(cand[(size_t)i * k + c]);
+                lists[cand[(size_t)i * k + c]].push_back(i);
+            }
+        }
+    }
+
+    /*  Adds the edges of t, a 1-tree of the complete graph, and rebuilds the
+        rows. Adding the edges the complete graph's 1-trees want keeps the
+        graph connected and its 1-trees close to those of the complete graph */
+    template <class Dist>
+    void add(const Dist &dist, const one_tree &t) {
+        int n = lists.size();
+        for (int e = 0; e < n; e++) {
+            lists[t.from[e]].push_back(t.to[e]);
+            lists[t.to[e]].push_back(t.from[e]);
+        }
+        start.assign(1, 0);
+        adj.clear();
+        weight.clear();
+        for (int i = 0; i < n; i++) {
+            std::sort(lists[i].begin(), lists[i].end());
+            lists[i].erase(std::unique(lists[i].begin(), lists[i].end()), lists[i].end());
+            for (size_t e = 0; e < lists[i].size(); e++) {
+                adj.push_back(lists[i][e]);
+                weight.push_back(dist(i, lists[i][e]));
+            }
+            start.push_back(adj.size());
+        }
+    }
+};
+
+/*  Lightest 1-tree within a candidate graph, Prim's algorithm with an
+    indexed binary heap in t.heap, with the slot of each node in t.pos,
+    in O(m log n) */
+inline void min_one_tree(const sparse_graph &g, int n, const double *pi, one_tree &t) {
+    t.from.resize(n);
+    t.to.resize(n);
+    t.key.assign(n, DBL_MAX);
+    t.link.assign(n, -1);
+    t.done.assign(n, 0);
+    t.heap.resize(n);
+    t.pos.assign(n, -1);
+    double *key = t.key.data();
+    int *heap = t.heap.data();
+    int *pos = t.pos.data();
+    int count = 0;
+
+    double length = 0;
+    int edges = 0;
+    t.done[0] = 1;
+    key[1] = 0;
+    heap[count] = 1;
+    pos[1] = count++;
+    while (count > 0) {
+        int u = heap[0];
+        pos[u] = -1;
+        int last = heap[--count];
+        if (count > 0) {
+            // sift the last entry down from the root
+            int h = 0;
+            while (true) {
+                int c = 2 * h + 1;
+                if (c >= count) {
+                    break;
+                }
+                if (c + 1 < count && key[heap[c + 1]] < key[heap[c]]) {
+                    c++;
+                }
+                if (key[heap[c]] >= key[last]) {
+                    break;
+                }
+                heap[h] = heap[c];
+                pos[heap[h]] = h;
+                h = c;
+            }
+            heap[h] = last;
+            pos[last] = h;
+        }
+
+        t.done[u] = 1;
+        if (t.link[u] >= 0) {
+            t.from[edges] = t.link[u];
+            t.to[edges++] = u;
+            length += key[u];
+        }
+        for (int e = g.start[u]; e < g.start[u + 1]; e++) {
+            int v = g.adj[e];
+            double c = g.weight[e] + pi[u] + pi[v];
+            if (t.done[v] || c >= key[v]) {
+                continue;
+            }
+            key[v] = c;
+            t.link[v] = u;
+            int h = pos[v];
+            if (h < 0) {
+                h = count++;
+            }
+            // sift v up from its slot
+            while (h > 0 && key[heap[(h - 1) / 2]] > c) {
+                heap[h] = heap[(h - 1) / 2];
+                pos[heap[h]] = h;
+                h = (h - 1) / 2;
+            }
+            heap[h] = v;
+            pos[v] = h;
+        }
+    }
+
+    double c1 = DBL_MAX, c2 = DBL_MAX;
+    int first = -1, second = -1;
+    for (int e = g.start[0]; e < g.start[1]; e++) {
+        double c = g.weight[e] + pi[0] + pi[g.adj[e]];
+        if (c < c1) {
+            second = first;
+            c2 = c1;
+            first = g.adj[e];
+            c1 = c;
+        } else if (c < c2) {
+            second = g.adj[e];
+            c2 = c;
+        }
+    }
+    t.from[n - 2] = t.from[n - 1] = 0;
+    t.to[n - 2] = first;
+    t.to[n - 1] = second;
+    finish_one_tree(t, n, length + c1 + c2, pi);
+}
+
+/*  Runs up to 'iters' subgradient steps from the penalties in pi and returns
+    the best bound found, leaving its penalties in pi and its 1-tree in t.
+    Steps are lambda * (upper - bound) / |degree - 2|^2, with lambda halved
+    after 'period' steps without improvement. Stops early once the bound
+    reaches 'enough', the 1-tree is a tour or wall_time() passes deadline
+    (0 for none), and returns DBL_MAX if no 1-tree exists */
+inline double subgradient_bound(const double *w, int n, const char *state, std::vector<double> &pi,
+                                double upper, double enough, int iters, double lambda, int period,
+                                one_tree &t, double deadline = 0) {
+    std::vector<double> best_pi = pi;
+    double best = -DBL_MAX;
+    bool current = true;        // t holds the 1-tree of best_pi
+    int stall = 0;
+    for (int it = 0; it < iters; it++) {
+        if (!min_one_tree(w, n, state, pi.data(), t)) {
+            return DBL_MAX;
+        }
+        current = false;
+        if (t.bound > best) {
+            best = t.bound;
+            best_pi = pi;
+            current = true;
+            stall = 0;
+        } else if (++stall >= period) {
+            lambda /= 2;
+            stall = 0;
+        }
+        if (t.bound >= enough || t.is_tour() || (deadline > 0 && wall_time() > deadline)) {
+            break;
+        }
+
+        double norm = 0;
+        for (int i = 0; i < n; i++) {
+            norm += (t.degree[i] - 2) * (t.degree[i] - 2);
+        }
+        double step = lambda * (upper - t.bound) / norm;
+        if (step <= 0) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            pi[i] += step * (t.degree[i] - 2);
+        }
+    }
+
+    pi.swap(best_pi);
+    if (!current) {
+        min_one_tree(w, n, state, pi.data(), t);
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/*  Hardware counter instrumentation for named solver regions
+    Build with -DTSP_PERF (make PERF=1) to enable, otherwise PERF_REGION
+    compiles to nothing. A PERF_REGION(name) statement counts cycles,
+    instructions, last level cache misses and branch misses, plus wall time,
+    from that point to the end of the enclosing scope on the calling thread.
+    Counters are opened per thread with perf_event_open on first use; when the
+    kernel refuses them (see /proc/sys/kernel/perf_event_paranoid) only times
+    are reported. At exit a per-thread summary is printed to stderr, with each
+    thread's busy time (inside any outermost region) and idle time (the rest
+    of the span from the first region entered to exit).
+*/
+#ifndef PERF_H
+#define PERF_H
+
+#ifdef TSP_PERF
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTERS
+};
+
+static const char *const perf_counter_names[PERF_COUNTERS] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+static const unsigned long long perf_counter_configs[PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+inline double perf_now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Accumulated measurements of one region on one thread
+struct perf_totals {
+    long long calls;
+    double seconds;
+    unsigned long long counts[PERF_COUNTERS];
+};
+
+// Counters and per-region totals of one thread
+struct perf_thread {
+    int id;
+    int fd[PERF_COUNTERS];
+    int depth;
+    double busy;
+    std::map<std::string, perf_totals> regions;
+
+    perf_thread(int id) : id(id), depth(0), busy(0) {
+        for (int c = 0; c < PERF_COUNTERS; c++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = perf_counter_configs[c];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // pid 0 and cpu -1: this thread, on whichever core it runs
+            fd[c] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+
+    void read_counts(unsigned long long *out) {
+        for (int c = 0; c < PERF_COUNTERS; c++) {
+            out[c] = 0;
+            if (fd[c] >= 0 && read(fd[c], &out[c], sizeof(out[c])) != sizeof(out[c])) {
+                out[c] = 0;
+            }
+        }
+    }
+};
+
+// All threads that entered a region, summarized when the program exits
+struct perf_registry {
+    std::mutex lock;
+    std::vector<perf_thread *> threads;
+    double start;
+
+    perf_registry() : start(0) {}
+
+    perf_thread *attach() {
+        std::lock_guard<std::mutex> guard(lock);
+        perf_thread *t = new perf_thread(threads.size());
+        threads.push_back(t);
+        if (threads.size() == 1) {
+            start = perf_now();
+        }
+        return t;
+    }
+
+    ~perf_registry() {
+        double span = perf_now() - start;
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < threads.size(); i++) {
+            perf_thread *t = threads[i];
+            if (t->fd[0] < 0) {
+                fprintf(stderr, "perf: thread %d: hardware counters unavailable, times only\n", t->id);
+            }
+            fprintf(stderr, "perf: thread %d: busy = %.6f s, idle = %.6f s\n", t->id, t->busy,
+                    span > t->busy ? span - t->busy : 0.0);
+            for (auto &r : t->regions) {
+                perf_totals &p = r.second;
+                fprintf(stderr, "perf: thread %d: %-14s calls = %lld, time = %.6f s", t->id,
+                        r.first.c_str(), p.calls, p.seconds);
+                for (int c = 0; c < PERF_COUNTERS; c++) {
+                    if (t->fd[c] >= 0) {
+                        fprintf(stderr, ", %s = %llu", perf_counter_names[c], p.counts[c]);
+                    }
+                }
+                if (p.counts[PERF_CYCLES]) {
+                    fprintf(stderr, ", ipc = %.2f", p.counts[PERF_INSTRUCTIONS] / (double)p.counts[PERF_CYCLES]);
+                }
+                fprintf(stderr, "\n");
+            }
+        }
+    }
+};
+
+inline perf_registry perf_state;
+
+inline perf_thread *perf_current() {
+    thread_local perf_thread *t = perf_state.attach();
+    return t;
+}
+
+// Measures from construction to destruction and adds the result to a region
+struct perf_scope {
+    const char *name;
+    perf_thread *t;
+    double start;
+    unsigned long long counts[PERF_COUNTERS];
+
+    perf_scope(const char *name) : name(name), t(perf_current()) {
+        t->depth++;
+        t->read_counts(counts);
+        start = perf_now();
+    }
+
+    ~perf_scope() {
+        double seconds = perf_now() - start;
+        unsigned long long end[PERF_COUNTERS];
+        t->read_counts(end);
+        perf_totals &p = t->regions[name];
+        p.calls++;
+        p.seconds += seconds;
+        for (int c = 0; c < PERF_COUNTERS; c++) {
+            p.counts[c] += end[c] - counts[c];
+        }
+        if (--t->depth == 0) {
+            t->busy += seconds;
+        }
+    }
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+#define PERF_REGION(name) perf_scope PERF_CONCAT(perf_scope_, __LINE__)(name)
+
+#else
+
+#define PERF_REGION(name) ((void)0)
+
+#endif
+
+#endif
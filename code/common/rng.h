@@ -0,0 +1,114 @@
+/*  Counter-based random number generator (Philox4x32-10) shared by the
+    stochastic solvers.
+    A generator is keyed by a global seed and addressed by a counter made of
+    (generation, individual, stream), so every draw depends only on where it
+    is used and never on which thread happens to run it. Construction is free,
+    there is no state to warm up with discard().
+*/
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Distinguishes independent uses of the same (generation, individual) pair
+enum rng_stream {
+    STREAM_INIT = 0,
+    STREAM_SELECT = 1,
+    STREAM_BREED = 2,
+    STREAM_SHUFFLE = 3,
+    STREAM_ANNEAL = 4,
+    STREAM_EXCHANGE = 5,
+    STREAM_ANTS = 6,
+    STREAM_REFILL = 7,
+    STREAM_KICK = 8
+};
+
+class philox_rng {
+public:
+    typedef uint32_t result_type;
+
+    philox_rng(uint64_t seed, uint32_t generation, uint32_t individual, uint32_t stream = 0) {
+        key[0] = (uint32_t)seed;
+        key[1] = (uint32_t)(seed >> 32);
+        ctr[0] = 0;
+        ctr[1] = individual;
+        ctr[2] = generation;
+        ctr[3] = stream;
+        left = 0;
+    }
+
+    static result_type min() { return 0; }
+    static result_type max() { return 0xffffffffu; }
+
+    // Returns the next 32 random bits, generating a new block of 4 when empty
+    result_type operator()() {
+        if (left == 0) {
+            block();
+            ctr[0]++;
+            left = 4;
+        }
+        return out[--left];
+    }
+
+    // Returns a uniform integer in [0, bound) using Lemire's multiply-shift
+    uint32_t below(uint32_t bound) {
+        uint64_t m = (uint64_t)(*this)() * bound;
+        uint32_t l = (uint32_t)m;
+        if (l < bound) {
+            uint32_t t = -bound % bound;
+            while (l < t) {
+                m = (uint64_t)(*this)() * bound;
+                l = (uint32_t)m;
+            }
+        }
+        return (uint32_t)(m >> 32);
+    }
+
+    // Returns a uniform double in [0, 1) with 53 bits of precision
+    double uniform() {
+        uint64_t hi = (*this)() >> 5;
+        uint64_t lo = (*this)() >> 6;
+        return (hi * 67108864.0 + lo) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint32_t key[2];
+    uint32_t ctr[4];
+    uint32_t out[4];
+    int left;
+
+    // Ten Philox rounds over the current counter
+    void block() {
+        uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int r = 0; r < 10; r++) {
+            uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+            uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            c1 = (uint32_t)p1;
+            c3 = (uint32_t)p0;
+            c0 = n0;
+            c2 = n2;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+};
+
+// Fisher-Yates shuffle of v[0..len) driven by rng
+template <typename T>
+void rng_shuffle(T *v, int len, philox_rng &rng) {
+    for (int i = len - 1; i > 0; i--) {
+        int j = rng.below(i + 1);
+        T tmp = v[i];
+        v[i] = v[j];
+        v[j] = tmp;
+    }
+}
+
+#endif
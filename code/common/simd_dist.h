@@ -0,0 +1,223 @@
+/*  Vectorized EUC_2D distance kernels
+    Each kernel computes TSPLIB-rounded distances for a whole block of cities
+    from the SoA coordinates, in double precision like coord_dist so results
+    are identical to the scalar oracle. The widest instruction set the CPU
+    supports (AVX-512, AVX2 or none) is picked once at runtime, so the
+    solvers need no extra compiler flags.
+*/
+#ifndef SIMD_DIST_H
+#define SIMD_DIST_H
+
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_DIST_X86
+#endif
+
+enum simd_level {
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// Returns the widest instruction set usable on this CPU
+inline simd_level simd_support() {
+#ifdef SIMD_DIST_X86
+    static const simd_level level = __builtin_cpu_supports("avx512f") ? SIMD_AVX512 :
+                                    __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+    return level;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+// Scalar EUC_2D distance, the reference for every kernel below
+inline float euc_2d(double dx, double dy) {
+    return (int)(sqrt(dx * dx + dy * dy) + 0.5);
+}
+
+
+namespace simd_detail {
+
+inline void euc_2d_row_scalar(const float *x, const float *y, float xi, float yi, int count, float *out) {
+    for (int j = 0; j < count; j++) {
+        out[j] = euc_2d((double)xi - x[j], (double)yi - y[j]);
+    }
+}
+
+inline double euc_2d_next_length_scalar(const float *x, const float *y, const int *next, int n) {
+    double length = 0;
+    for (int i = 0; i < n; i++) {
+        length += euc_2d((double)x[i] - x[next[i]], (double)y[i] - y[next[i]]);
+    }
+    return length;
+}
+
+inline double euc_2d_order_length_scalar(const float *x, const float *y, const int *order, int n) {
+    double length = 0;
+    for (int k = 0; k < n; k++) {
+        int a = order[k], b = order[k + 1 == n ? 0 : k + 1];
+        length += euc_2d((double)x[a] - x[b], (double)y[a] - y[b]);
+    }
+    return length;
+}
+
+#ifdef SIMD_DIST_X86
+
+// Coordinates are widened before subtracting, as in the scalar oracle
+__attribute__((target("avx2")))
+inline __m256d euc_2d_avx2(__m128 xa, __m128 ya, __m128 xb, __m128 yb) {
+    __m256d dx = _mm256_sub_pd(_mm256_cvtps_pd(xa), _mm256_cvtps_pd(xb));
+    __m256d dy = _mm256_sub_pd(_mm256_cvtps_pd(ya), _mm256_cvtps_pd(yb));
+    __m256d d = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+    return _mm256_floor_pd(_mm256_add_pd(d, _mm256_set1_pd(0.5)));
+}
+
+__attribute__((target("avx2")))
+inline void euc_2d_row_avx2(const float *x, const float *y, float xi, float yi, int count, float *out) {
+    __m128 vx = _mm_set1_ps(xi), vy = _mm_set1_ps(yi);
+    int j = 0;
+    for (; j + 4 <= count; j += 4) {
+        __m256d d = euc_2d_avx2(vx, vy, _mm_loadu_ps(x + j), _mm_loadu_ps(y + j));
+        _mm_storeu_ps(out + j, _mm256_cvtpd_ps(d));
+    }
+    euc_2d_row_scalar(x + j, y + j, xi, yi, count - j, out + j);
+}
+
+__attribute__((target("avx2")))
+inline double euc_2d_next_length_avx2(const float *x, const float *y, const int *next, int n) {
+    __m256d sum = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i idx = _mm_loadu_si128((const __m128i *)(next + i));
+        __m256d d = euc_2d_avx2(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i),
+                                _mm_i32gather_ps(x, idx, 4), _mm_i32gather_ps(y, idx, 4));
+        sum = _mm256_add_pd(sum, d);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    double length = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; i++) {
+        length += euc_2d((double)x[i] - x[next[i]], (double)y[i] - y[next[i]]);
+    }
+    return length;
+}
+
+__attribute__((target("avx2")))
+inline double euc_2d_order_length_avx2(const float *x, const float *y, const int *order, int n) {
+    __m256d sum = _mm256_setzero_pd();
+    int k = 0;
+    for (; k + 5 <= n; k += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(order + k));
+        __m128i b = _mm_loadu_si128((const __m128i *)(order + k + 1));
+        __m256d d = euc_2d_avx2(_mm_i32gather_ps(x, a, 4), _mm_i32gather_ps(y, a, 4),
+                                _mm_i32gather_ps(x, b, 4), _mm_i32gather_ps(y, b, 4));
+        sum = _mm256_add_pd(sum, d);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    double length = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; k < n; k++) {
+        int a = order[k], b = order[k + 1 == n ? 0 : k + 1];
+        length += euc_2d((double)x[a] - x[b], (double)y[a] - y[b]);
+    }
+    return length;
+}
+
+__attribute__((target("avx512f")))
+inline __m512d euc_2d_avx512(__m256 xa, __m256 ya, __m256 xb, __m256 yb) {
+    __m512d dx = _mm512_sub_pd(_mm512_cvtps_pd(xa), _mm512_cvtps_pd(xb));
+    __m512d dy = _mm512_sub_pd(_mm512_cvtps_pd(ya), _mm512_cvtps_pd(yb));
+    __m512d d = _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)));
+    return _mm512_roundscale_pd(_mm512_add_pd(d, _mm512_set1_pd(0.5)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+}
+
+__attribute__((target("avx512f")))
+inline void euc_2d_row_avx512(const float *x, const float *y, float xi, float yi, int count, float *out) {
+    __m256 vx = _mm256_set1_ps(xi), vy = _mm256_set1_ps(yi);
+    int j = 0;
+    for (; j + 8 <= count; j += 8) {
+        __m512d d = euc_2d_avx512(vx, vy, _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j));
+        _mm256_storeu_ps(out + j, _mm512_cvtpd_ps(d));
+    }
+    euc_2d_row_scalar(x + j, y + j, xi, yi, count - j, out + j);
+}
+
+__attribute__((target("avx512f")))
+inline double euc_2d_next_length_avx512(const float *x, const float *y, const int *next, int n) {
+    __m512d sum = _mm512_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(next + i));
+        __m512d d = euc_2d_avx512(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i),
+                                  _mm256_i32gather_ps(x, idx, 4), _mm256_i32gather_ps(y, idx, 4));
+        sum = _mm512_add_pd(sum, d);
+    }
+    double length = _mm512_reduce_add_pd(sum);
+    for (; i < n; i++) {
+        length += euc_2d((double)x[i] - x[next[i]], (double)y[i] - y[next[i]]);
+    }
+    return length;
+}
+
+__attribute__((target("avx512f")))
+inline double euc_2d_order_length_avx512(const float *x, const float *y, const int *order, int n) {
+    __m512d sum = _mm512_setzero_pd();
+    int k = 0;
+    for (; k + 9 <= n; k += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(order + k));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(order + k + 1));
+        __m512d d = euc_2d_avx512(_mm256_i32gather_ps(x, a, 4), _mm256_i32gather_ps(y, a, 4),
+                                  _mm256_i32gather_ps(x, b, 4), _mm256_i32gather_ps(y, b, 4));
+        sum = _mm512_add_pd(sum, d);
+    }
+    double length = _mm512_reduce_add_pd(sum);
+    for (; k < n; k++) {
+        int a = order[k], b = order[k + 1 == n ? 0 : k + 1];
+        length += euc_2d((double)x[a] - x[b], (double)y[a] - y[b]);
+    }
+    return length;
+}
+
+#endif
+
+}
+
+
+// out[j] = distance from (xi, yi) to city j, for j in [0, count)
+inline void euc_2d_row(const float *x, const float *y, float xi, float yi, int count, float *out) {
+#ifdef SIMD_DIST_X86
+    switch (simd_support()) {
+        case SIMD_AVX512: simd_detail::euc_2d_row_avx512(x, y, xi, yi, count, out); return;
+        case SIMD_AVX2: simd_detail::euc_2d_row_avx2(x, y, xi, yi, count, out); return;
+        default: break;
+    }
+#endif
+    simd_detail::euc_2d_row_scalar(x, y, xi, yi, count, out);
+}
+
+// Length of a tour given as successors, city i is followed by next[i]
+inline double euc_2d_next_length(const float *x, const float *y, const int *next, int n) {
+#ifdef SIMD_DIST_X86
+    switch (simd_support()) {
+        case SIMD_AVX512: return simd_detail::euc_2d_next_length_avx512(x, y, next, n);
+        case SIMD_AVX2: return simd_detail::euc_2d_next_length_avx2(x, y, next, n);
+        default: break;
+    }
+#endif
+    return simd_detail::euc_2d_next_length_scalar(x, y, next, n);
+}
+
+// Length of a tour given as the order cities are visited in
+inline double euc_2d_order_length(const float *x, const float *y, const int *order, int n) {
+#ifdef SIMD_DIST_X86
+    switch (simd_support()) {
+        case SIMD_AVX512: return simd_detail::euc_2d_order_length_avx512(x, y, order, n);
+        case SIMD_AVX2: return simd_detail::euc_2d_order_length_avx2(x, y, order, n);
+        default: break;
+    }
+#endif
+    return simd_detail::euc_2d_order_length_scalar(x, y, order, n);
+}
+
+#endif
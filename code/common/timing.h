@@ -0,0 +1,73 @@
+/*  Wall-clock phase timing for solver runs
+    A run is split into consecutive phases: reading the instance, allocating
+    (and releasing) the solver's tables, the search itself and building the
+    answer from the finished tables. Each mark charges the time since the
+    previous mark to one phase, so the phases always add up to the whole run.
+*/
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+
+enum run_phase {
+    PHASE_PARSE,
+    PHASE_ALLOC,
+    PHASE_SOLVE,
+    PHASE_RECONSTRUCT,
+    PHASE_COUNT
+};
+
+static const char *const phase_names[PHASE_COUNT] = {"parse", "alloc", "solve", "reconstruct"};
+
+// Seconds on a monotonic clock
+inline double wall_time() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct phase_timer {
+    double seconds[PHASE_COUNT];
+    double last;
+
+    phase_timer() {
+        reset();
+    }
+
+    void reset() {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            seconds[p] = 0;
+        }
+        last = wall_time();
+    }
+
+    // Charges the time since the previous mark to phase p
+    void mark(run_phase p) {
+        double now = wall_time();
+        seconds[p] += now - last;
+        last = now;
+    }
+
+    // Restarts the clock without charging the time since the previous mark
+    double skip() {
+        double now = wall_time();
+        double skipped = now - last;
+        last = now;
+        return skipped;
+    }
+
+    double total() const {
+        double sum = 0;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            sum += seconds[p];
+        }
+        return sum;
+    }
+};
+
+// Solvers take an optional timer, standalone runs pass none
+inline void mark_phase(phase_timer *timer, run_phase p) {
+    if (timer) {
+        timer->mark(p);
+    }
+}
+
+#endif
@@ -4,19 +4,26 @@
    lengths, until convergence or the max number of iterations */
 
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
 #include <vector>
 #include <math.h>
-#include <random>
+#include <unordered_set>
 #include <omp.h>
 #include "../parse/parser.h"
+#include "../common/rng.h"
+#include "../libtsp/tsp.h"
+#include "../common/perf.h"
 
 using namespace std;
 
+namespace genetic {
+
 // Represents an individual solution
 struct individual {
     vector<int> cities;
-    int path_len;
+    double path_len;        // accumulated in double so float distances do not drift
+    unsigned long long hash; // XOR of edge keys, same for any rotation/direction of the tour
     int rank;
     int offset; // used in roulette selection
 };
@@ -34,26 +41,21 @@ struct population {
     parents *pars;
 };
 
-// Global variables
-bool is_matrix;
-int n;
-vector<vector<float> > G;
-vector<float> X, Y;
-
-// Returns the distance from node i to node j
-float dist(int i, int j) {
-    if (is_matrix) {
-        return G[i][j];
-    } else {
-        int dx = X[i] - X[j];
-        int dy = Y[i] - Y[j];
-        // Round to be consistent with official TSPLIB solutions
-        return (int)(sqrt(dx * dx + dy * dy) + 0.5);
+/*  Returns the Zobrist key of the undirected edge {i, j}
+    The key is a splitmix64 scramble of the sorted edge, so no table is needed */
+unsigned long long edge_key(int i, int j) {
+    if (i > j) {
+        swap(i, j);
     }
+    unsigned long long z = ((unsigned long long)i << 32 | j) + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
 }
 
 // Generate a random, initial population of size n
-population generate_initial() {
+template <class Dist>
+population generate_initial(const Dist &dist, int n, unsigned long long seed) {
     population pop;
     pop.ids = (individual *)calloc(n, sizeof(individual));
     pop.pars = (parents *)calloc(n, sizeof(parents));
@@ -63,14 +65,13 @@ population generate_initial() {
         individual ind;
         vector<int> visited;
         // pick a random starting city
-        default_random_engine gen((omp_get_thread_num() + 1) * n + i);
-        uniform_int_distribution<int> distribution(0, n - 1);
-        gen.discard(10000);
-        int c = distribution(gen);
+        philox_rng gen(seed, 0, i, STREAM_INIT);
+        int c = gen.below(n);
         int oc = c;
         ind.cities.push_back(c);
         visited.push_back(c);
-        int length = 0;
+        double length = 0;
+        unsigned long long hash = 0;
         while (visited.size() < n) {
             // pick a random vertex that hasn't been visited yet
             vector<int> next;
@@ -80,17 +81,19 @@ population generate_initial() {
                     next.push_back(j);
                 }
             }
-            uniform_int_distribution<int> dist_next(0, next.size() - 1);
-            int nci = dist_next(gen);
+            int nci = gen.below(next.size());
             int nc = next[nci];
             ind.cities.push_back(nc);
             length += dist(c, nc);
+            hash ^= edge_key(c, nc);
             c = nc;
             visited.push_back(nc);
         // continue until all cities visited
         }
         length += dist(c, oc);
+        hash ^= edge_key(c, oc);
         ind.path_len = length;
+        ind.hash = hash;
         pop.ids[i] = ind;
     }
 
@@ -115,7 +118,7 @@ individual roulette_selection(population pop, int r) {
 }
 
 // Given population of size p, select p-1 pairs of parents for the next generation
-void select_parents(population &pop) {
+void select_parents(population &pop, unsigned long long seed, int generation) {
     sort(pop.ids, pop.ids + pop.size, ind_compare);
     // assign ranks and offsets
     int offset = 0;
@@ -131,11 +134,9 @@ void select_parents(population &pop) {
     // Use roulette selection to select pairs of parents
     #pragma omp parallel for schedule(static)
     for (int i = 0; i < pop.size - 1; i++) {
-        default_random_engine gen((i + 1) * (omp_get_thread_num() + 1) * pop.size);
-        uniform_int_distribution<int> distribution(0, max - 1);
-        gen.discard(10000);
-        int r1 = distribution(gen);
-        int r2 = distribution(gen);
+        philox_rng gen(seed, generation, i, STREAM_SELECT);
+        int r1 = gen.below(max);
+        int r2 = gen.below(max);
         parents p;
         p.p1 = roulette_selection(pop, r1);
         p.p2 = roulette_selection(pop, r2);
@@ -144,26 +145,26 @@ void select_parents(population &pop) {
 }
 
 // Given two parents, apply a greedy crossover method to create one new individaul
-individual crossover(individual &p1, individual &p2, int seed) {
+template <class Dist>
+individual crossover(const Dist &dist, individual &p1, individual &p2, philox_rng &gen) {
+    int n = p1.cities.size();
     individual ind;
     // pick a random starting city
-    default_random_engine gen(seed);
-    uniform_int_distribution<int> distribution(0, n - 1);
-    gen.discard(10000);
-    int c = distribution(gen);
+    int c = gen.below(n);
     int oc = c;
     ind.cities.push_back(c);
     vector<int> visited;
     visited.push_back(c);
-    int length = 0;
+    double length = 0;
+    unsigned long long hash = 0;
     while (visited.size() < n) {
         // figure out what cities (c1 and c2) come next in p1 and p2 respectively
         int ci1 = (find(p1.cities.begin(), p1.cities.end(), c)) - p1.cities.begin();
         int ci2 = (find(p2.cities.begin(), p2.cities.end(), c)) - p2.cities.begin();
         int c1 = p1.cities[(ci1 + 1) % n];
         int c2 = p2.cities[(ci2 + 1) % n];
-        int w1 = dist(c, c1);
-        int w2 = dist(c, c2);
+        float w1 = dist(c, c1);
+        float w2 = dist(c, c2);
         
         bool cycle = false;
         // select the closer city that doesn't create a cycle
@@ -176,6 +177,7 @@ individual crossover(individual &p1, individual &p2, int seed) {
             else {
                 ind.cities.push_back(c1);
                 length += dist(c, c1);
+                hash ^= edge_key(c, c1);
                 c = c1;
                 visited.push_back(c1);
             }
@@ -185,6 +187,7 @@ individual crossover(individual &p1, individual &p2, int seed) {
             } else {
                 ind.cities.push_back(c2);
                 length += dist(c, c2);
+                hash ^= edge_key(c, c2);
                 c = c2;
                 visited.push_back(c2);
             }
@@ -199,6 +202,7 @@ individual crossover(individual &p1, individual &p2, int seed) {
                 } else {
                     ind.cities.push_back(c1);
                     length += dist(c, c1);
+                    hash ^= edge_key(c, c1);
                     c = c1;
                     visited.push_back(c1);
                 }
@@ -208,6 +212,7 @@ individual crossover(individual &p1, individual &p2, int seed) {
                 } else {
                     ind.cities.push_back(c2);
                     length += dist(c, c2);
+                    hash ^= edge_key(c, c2);
                     c = c2;
                     visited.push_back(c2);
                 }
@@ -224,11 +229,11 @@ individual crossover(individual &p1, individual &p2, int seed) {
                     next.push_back(j);
                 }
             }
-            uniform_int_distribution<int> dist_next(0, next.size() - 1);
-            int nci = dist_next(gen);
+            int nci = gen.below(next.size());
             int nc = next[nci];
             ind.cities.push_back(nc);
             length += dist(c, nc);
+            hash ^= edge_key(c, nc);
             c = nc;
             visited.push_back(nc);
         }
@@ -236,48 +241,229 @@ individual crossover(individual &p1, individual &p2, int seed) {
     // repeat until all cities visited
     }
     length += dist(c, oc);
+    hash ^= edge_key(c, oc);
     ind.path_len = length;
+    ind.hash = hash;
     return ind;
 }
 
+/*  Returns the positions k whose edges (cities[k], cities[k + 1]) touch
+    position i1 or i2, without duplicates when i1 and i2 are adjacent */
+int touched_edges(int i1, int i2, int n, int *edges) {
+    int cand[4] = {(i1 + n - 1) % n, i1, (i2 + n - 1) % n, i2};
+    int count = 0;
+    for (int a = 0; a < 4; a++) {
+        if (find(edges, edges + count, cand[a]) == edges + count) {
+            edges[count++] = cand[a];
+        }
+    }
+    return count;
+}
+
+// Swaps the cities at positions i1 and i2, updating the length and hash in O(1)
+template <class Dist>
+void swap_cities(const Dist &dist, individual &i, int i1, int i2, int n) {
+    if (i1 == i2) {
+        return;
+    }
+    int edges[4];
+    int count = touched_edges(i1, i2, n, edges);
+    vector<int> &t = i.cities;
+    for (int e = 0; e < count; e++) {
+        int a = t[edges[e]], b = t[(edges[e] + 1) % n];
+        i.path_len -= dist(a, b);
+        i.hash ^= edge_key(a, b);
+    }
+    int tmp = t[i2];
+    t[i2] = t[i1];
+    t[i1] = tmp;
+    for (int e = 0; e < count; e++) {
+        int a = t[edges[e]], b = t[(edges[e] + 1) % n];
+        i.path_len += dist(a, b);
+        i.hash ^= edge_key(a, b);
+    }
+}
+
 // mutate individual with a 2.1% probability
-void mutate(individual &i, int n, int seed) {
-    default_random_engine gen(seed);
-    uniform_int_distribution<int> distribution(0, 999);
-    gen.discard(10000);
-    if (distribution(gen) <= 21) {
-        int i1 = distribution(gen) % n;
-        int i2 = distribution(gen) % n;
-        int tmp = i.cities[i2];
-        i.cities[i2] = i.cities[i1];
-        i.cities[i1] = tmp;
+template <class Dist>
+void mutate(const Dist &dist, individual &i, int n, philox_rng &gen) {
+    if (gen.below(1000) <= 21) {
+        int i1 = gen.below(n);
+        int i2 = gen.below(n);
+        swap_cities(dist, i, i1, i2, n);
     }
-    return;
 }
 
-// If pop size = 1 or all individuals are the same, have converged
-bool convergence(population pop, int n) {
+// If pop size = 1 or all individuals have the same tour, have converged
+bool convergence(population pop) {
     if (pop.size == 1) {
         return true;
     }
-    // check if all individuals of a population are the same
+    // compare edge hashes instead of walking every tour
+    unsigned long long h = pop.ids[0].hash;
+    bool same = true;
+    #pragma omp parallel for schedule(static) reduction(&&:same)
     for (int i = 1; i < pop.size; i++) {
-        individual i1 = pop.ids[i-1];
-        individual i2 = pop.ids[i];
-        int c1 = i1.cities[0];
-        int c2 = find(i2.cities.begin(), i2.cities.end(), c1) - i2.cities.begin();
-        for (int j = 0; j < n; j++) {
-            if (i1.cities[(c1 + j) % n] != i2.cities[(c2 + j) % n]) {
-                return false;
+        same = same && (pop.ids[i].hash == h);
+    }
+    return same;
+}
+
+/*  Remove individuals whose tour duplicates an earlier one, keeping the first
+    copy of each, and return the number of distinct tours left */
+int cull_duplicates(population &pop) {
+    unordered_set<unsigned long long> seen;
+    seen.reserve(2 * pop.size);
+    int size = 0;
+    for (int i = 0; i < pop.size; i++) {
+        if (seen.insert(pop.ids[i].hash).second) {
+            if (size != i) {
+                pop.ids[size] = pop.ids[i];
             }
+            size++;
         }
     }
-    return true;
+    pop.size = size;
+    return size;
 }
 
+/*  Refills the population up to size after cull_duplicates, each culled slot
+    taking a copy of a distinct tour with two random cities swapped */
+template <class Dist>
+void refill(const Dist &dist, population &pop, int size, int n, unsigned long long seed, int generation) {
+    int distinct = pop.size;
+    #pragma omp parallel for schedule(static)
+    for (int i = distinct; i < size; i++) {
+        philox_rng gen(seed, generation, i, STREAM_REFILL);
+        individual ind = pop.ids[(i - distinct) % distinct];
+        int i1 = gen.below(n);
+        int i2 = gen.below(n);
+        swap_cities(dist, ind, i1, i2, n);
+        pop.ids[i] = ind;
+    }
+    pop.size = size;
+}
+
+// Print diversity statistics for the current generation, distinct counted before the refill
+void print_generation(population &pop, int generation, int distinct) {
+    double best = pop.ids[0].path_len;
+    double total = 0;
+    for (int i = 0; i < pop.size; i++) {
+        best = min(best, pop.ids[i].path_len);
+        total += pop.ids[i].path_len;
+    }
+    printf("Generation %d: size = %d, distinct = %d, best = %.1f, mean = %.1f\n",
+           generation, pop.size, distinct, best, total / (double)pop.size);
+}
+
+/*  Evolves the population until convergence, or until the monitor reaches
+    its target gap, and keeps the best tour of any generation: breeding
+    replaces every tour but the best, which the shrinking then drops */
+struct genetic_run {
+    int n;
+    const tsp_options &opts;
+    phase_timer *timer;
+    double best_cost;
+    vector<int> best_tour;
+    int generations;
+
+    genetic_run(int n, const tsp_options &opts, phase_timer *timer)
+        : n(n), opts(opts), timer(timer), best_cost(0), generations(0) {}
+
+    // Keeps the shortest tour of the population if it beats the best so far
+    void keep_best(const population &pop) {
+        int best = 0;
+        for (int i = 1; i < pop.size; i++) {
+            if (pop.ids[i].path_len < pop.ids[best].path_len) {
+                best = i;
+            }
+        }
+        if (best_tour.empty() || pop.ids[best].path_len < best_cost) {
+            best_cost = pop.ids[best].path_len;
+            best_tour = pop.ids[best].cities;
+        }
+    }
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        unsigned long long seed = opts.seed;
+        int generation = 0;
+        population pop = generate_initial(dist, n, seed);
+
+        while (!convergence(pop)) {
+            /*  duplicates only take selection slots away from distinct tours,
+                so they are replaced by variations of the distinct ones */
+            int size = pop.size;
+            int distinct = cull_duplicates(pop);
+            refill(dist, pop, size, n, seed, generation);
+            if (opts.print_stats) {
+                print_generation(pop, generation, distinct);
+            }
+            keep_best(pop);
+            if (opts.monitor) {
+                opts.monitor->offer_upper(best_cost);
+            }
+            if (pop.size == 1 || (opts.monitor && opts.monitor->reached())) {
+                break;
+            }
+            select_parents(pop, seed, generation);
+
+            #pragma omp parallel
+            {
+                PERF_REGION("ga_generation");
+                #pragma omp for schedule(dynamic) nowait
+                for (int i = 0; i < pop.size - 1; i++) {
+                    // keyed by (generation, i) so the result is independent of the thread count
+                    philox_rng gen(seed, generation, i, STREAM_BREED);
+                    parents p = pop.pars[i];
+                    individual ind = crossover(dist, p.p1, p.p2, gen);
+                    mutate(dist, ind, n, gen);
+                    pop.ids[i] = ind;
+                }
+            }
+            pop.size -= 1;
+            generation++;
+        }
+        generations = generation;
+        mark_phase(timer, PHASE_SOLVE);
+
+        keep_best(pop);
+        normalize_tour(best_tour);
+        mark_phase(timer, PHASE_RECONSTRUCT);
+
+        /*  The arrays are calloc'd and filled by assignment, so slots never assigned
+            are zeroed vectors, which destruct like empty ones */
+        for (int i = 0; i < n; i++) {
+            pop.ids[i].~individual();
+            pop.pars[i].~parents();
+        }
+        free(pop.ids);
+        free(pop.pars);
+        mark_phase(timer, PHASE_ALLOC);
+    }
+};
+
+
+// Evolves a population on a parsed instance and returns its best tour
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    genetic_run solver(inst.n, opts, timer);
+    dispatch_metric(inst, solver);
+
+    tsp_result result;
+    result.cost = solver.best_cost;
+    result.tour.swap(solver.best_tour);
+    result.stats.push_back(tsp_stat("generations", solver.generations));
+    return result;
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
 int main(int argc, char *argv[]) {
     int num_threads = omp_get_max_threads();
     string file_name = "";
+    tsp_options opts;
     // Check if thread count is passed in as a command line argument
     for (int i = 0; i < argc; i++) {
         string arg(argv[i]);
@@ -286,6 +472,10 @@ int main(int argc, char *argv[]) {
         }  else if (arg == "-t" && i + 1 < argc) {
             num_threads = atoi(argv[i + 1]);
             omp_set_num_threads(num_threads);
+        } else if (arg == "-s") {
+            opts.print_stats = true;
+        } else if (arg == "-seed" && i + 1 < argc) {
+            opts.seed = strtoull(argv[i + 1], NULL, 10);
         }
     }
 
@@ -294,14 +484,11 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    is_matrix = (file_name.find(".mat") != string::npos);
-    if (is_matrix) {
-        n = parse_matrix(file_name, G);
-    } else {
-        n = parse_euc_2d(file_name, X, Y);
-    }
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
 
-    if (n > 500) {
+    if (inst.n > 500) {
         cout << "Please run on a smaller graph with at most 500 vertices" << endl;
         return 0;
     }
@@ -309,33 +496,8 @@ int main(int argc, char *argv[]) {
     cout << "Running with " << num_threads << " threads" << endl;
 
     // Genetic algorithm
-    population pop = generate_initial();
-
-    while (!convergence(pop, n)) {
-        select_parents(pop);
- 
-        #pragma omp parallel for schedule(dynamic)
-        for (int i = 0; i < pop.size - 1; i++) {
-            int seed = (omp_get_thread_num() + 1) * (i + 1);
-            parents p = pop.pars[i];
-            individual ind = crossover(p.p1, p.p2, seed);
-            mutate(ind, n, seed);
-            pop.ids[i] = ind;
-        }
-        pop.size -= 1;
-    }
-    
-    // Find best solution in population
-    int best_tour = pop.ids[0].path_len;
-    if (pop.size > 1) {
-        for (int i = 1; i < pop.size; i++) {
-            if (pop.ids[i].path_len < best_tour) {
-                best_tour = pop.ids[i].path_len;
-            }
-        }
-    }
-
-    printf("Tour cost = %d\n", best_tour);
+    cout << "Tour cost = " << setprecision(12) << genetic::solve(inst, opts).cost << endl;
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,43 +1,426 @@
 /*  Parallel Held-Karp Algorithm for the Metric TSP Problem
-    Input: the number of cities n followed by the full matrix of distances.
+    Input: any instance the parser reads, distances go through the shared oracle.
     Output: The cost of the optimal tour.
+    With a checkpoint file every completed layer of the table is appended to
+    it on a background thread while the next layer is computed, and a run
+    given the same file resumes after the last layer found complete in it.
 */
 #include <iostream>
 #include <vector>
+#include <string>
+#include <thread>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <stdlib.h>
 #include <float.h>
+#include <unistd.h>
 #include <omp.h>
 #include "../parse/parser.h"
+#include "../libtsp/tsp.h"
+#include "../common/perf.h"
 
 using namespace std;
 
+namespace held_karp_par {
 
-// Global variables
-int n;
-vector<vector<float> > G;
-
-
-/*  Return last row of Pascal's triangle
+/*  Return Pascal's triangle up to row n, B[a][b] = a choose b (0 for b > a)
     This function takes on the order of 1e-6 seconds so no point
     trying to optimize it any further
 */
-vector<int> pascals_triangle(int n) {
-    vector<vector<int> > T(n, vector<int>(n, 0));
-    T[0][0] = 1;
-    for (int i = 1; i < n; i++) {
-        T[i][0] = 1;
-        for (int j = 1; j < i; j++) {
-            T[i][j] = T[i - 1][j - 1] + T[i - 1][j];
+vector<vector<int> > pascals_triangle(int n) {
+    vector<vector<int> > B(n + 1, vector<int>(n + 1, 0));
+    for (int i = 0; i <= n; i++) {
+        B[i][0] = 1;
+        for (int j = 1; j <= i; j++) {
+            B[i][j] = B[i - 1][j - 1] + B[i - 1][j];
         }
-        T[i][i] = 1;
     }
-    return T[n - 1];
+    return B;
+}
+
+
+// Gosper's hack: the next larger set with as many elements as S
+inline unsigned int next_subset(unsigned int S) {
+    unsigned int c = S & -S;
+    unsigned int r = S + c;
+    return (((r ^ S) >> 2) / c) | r;
 }
 
 
+/*  Returns set number i of the sets of size p of {0, 1, ..., n - 1} in
+    increasing order, the order next_subset walks them in. In the
+    combinatorial number system i is the sum of B[c][j] over the elements
+    c of the set, the j-th smallest being counted as B[c][j], so its largest
+    element is the largest c with B[c][p] <= i, and so on down */
+unsigned int unrank_subset(long i, int p, int n, const vector<vector<int> > &B) {
+    unsigned int S = 0;
+    for (int c = n - 1; p > 0; c--) {
+        if (B[c][p] <= i) {
+            S |= 1u << c;
+            i -= B[c][p];
+            p--;
+        }
+    }
+    return S;
+}
+
+
+// Values a checkpoint layer is read and written in at a time
+const size_t CHUNK = 1 << 20;
+
+
+/*  Append-only checkpoint of the completed layers of the DP table
+    A header identifies the instance by n and a hash of its distances. Each
+    layer p follows as p and its number of values, the values C[S][k] of its
+    sets S without city 0 in increasing order with k ascending, and p
+    again, so a layer cut short by a crash is recognized and dropped. The
+    threads computing a layer also store its values in that order in one of
+    two buffers, so writing it is a single fwrite. Only one layer is written
+    at a time, on its own thread, from one buffer while the next layer fills
+    the other; layers are never changed once complete, so no lock is needed */
+struct layer_log {
+    int n;
+    float **C;
+    const vector<vector<int> > &B;
+    FILE *f;
+    vector<float> layers[2];  // values of layer p in layers[p & 1]
+    thread writer;
+    int pending;              // layer being written, 0 if none
+    bool failed;
+
+    layer_log(int n, float **C, const vector<vector<int> > &B)
+        : n(n), C(C), B(B), f(NULL), pending(0), failed(false) {}
+
+    ~layer_log() {
+        wait();
+        if (f) {
+            fclose(f);
+        }
+    }
+
+    /*  Opens path and returns the last complete layer of this instance in
+        it, after loading every complete layer into C and truncating what
+        follows them; 1 (nothing to resume) if the file is new or from
+        another instance, which it is then started over for */
+    int open(string path, uint64_t hash) {
+        const char magic[8] = "HKCKPT1";
+        uint64_t header[2] = {(uint64_t)n, hash};
+        int last = 1;
+        f = fopen(path.c_str(), "r+b");
+        char file_magic[8];
+        uint64_t file_header[2];
+        if (f && fread(file_magic, 8, 1, f) == 1 && memcmp(file_magic, magic, 8) == 0 &&
+            fread(file_header, sizeof(file_header), 1, f) == 1 && memcmp(file_header, header, sizeof(header)) == 0) {
+            long good = ftell(f);
+            while (last + 1 < n && read_layer(last + 1)) {
+                last++;
+                good = ftell(f);
+            }
+            fflush(f);
+            if (ftruncate(fileno(f), good) != 0 || fseek(f, good, SEEK_SET) != 0) {
+                last = 1;
+            }
+            if (last > 1) {
+                return last;
+            }
+        }
+        if (f) {
+            fclose(f);
+        }
+        f = fopen(path.c_str(), "w+b");
+        if (!f || fwrite(magic, 8, 1, f) != 1 || fwrite(header, sizeof(header), 1, f) != 1 || fflush(f) != 0) {
+            cerr << "Could not write checkpoint " << path << endl;
+            failed = true;
+        }
+        return 1;
+    }
+
+    // Number of values of layer p: p for every set of size p without city 0
+    uint64_t layer_values(int p) {
+        return (uint64_t)B[n - 1][p] * p;
+    }
+
+    // Buffer the values of layer p are stored in while it is computed
+    float *layer_buffer(int p) {
+        layers[p & 1].resize(layer_values(p));
+        return layers[p & 1].data();
+    }
+
+    // Reads layer p into C, returns false if it is missing or incomplete
+    bool read_layer(int p) {
+        uint64_t head[2], tail;
+        if (fread(head, sizeof(head), 1, f) != 1 || head[0] != (uint64_t)p || head[1] != layer_values(p)) {
+            return false;
+        }
+        vector<float> buf(CHUNK + n);
+        float *in = buf.data();
+        size_t used = 0, filled = 0;
+        unsigned int s = (1u << p) - 1;
+        for (int i = 0; i < B[n - 1][p]; i++, s = next_subset(s)) {
+            unsigned int S = s << 1;
+            if (used == filled) {
+                filled = min((uint64_t)CHUNK / p * p, head[1]);
+                if (fread(in, sizeof(float), filled, f) != filled) {
+                    return false;
+                }
+                head[1] -= filled;
+                used = 0;
+            }
+            float *row = C[S];
+            for (unsigned int rest = S; rest; rest &= rest - 1) {
+                row[__builtin_ctz(rest)] = in[used++];
+            }
+        }
+        return fread(&tail, sizeof(tail), 1, f) == 1 && tail == (uint64_t)p;
+    }
+
+    void write_layer(int p) {
+        uint64_t head[2] = {(uint64_t)p, layer_values(p)}, tail = p;
+        const vector<float> &values = layers[p & 1];
+        bool ok = fwrite(head, sizeof(head), 1, f) == 1 &&
+                  fwrite(values.data(), sizeof(float), values.size(), f) == values.size();
+        ok = ok && fwrite(&tail, sizeof(tail), 1, f) == 1 && fflush(f) == 0 && fdatasync(fileno(f)) == 0;
+        if (!ok) {
+            cerr << "Could not write layer " << p << " to the checkpoint" << endl;
+            failed = true;
+        }
+    }
+
+    /*  Writes layer p on the writer thread, once the previous layer is
+        written, which frees its buffer for layer p + 1 */
+    void write_async(int p) {
+        wait();
+        if (!failed) {
+            pending = p;
+            writer = thread(&layer_log::write_layer, this, p);
+        }
+    }
+
+    void wait() {
+        if (pending) {
+            writer.join();
+            pending = 0;
+        }
+    }
+};
+
+
+// FNV-1a hash of the distances, which identifies the instance of a checkpoint
+template <class Dist>
+uint64_t distance_hash(const Dist &G, int n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            float d = G(i, j);
+            uint32_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            h = (h ^ bits) * 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+
+/*  Fills the DP table C bottom-up and keeps the optimal tour and its cost,
+    or with 'open' the shortest path from city 0 to every other city */
+struct held_karp_run {
+    int n;
+    float **C;
+    vector<vector<int> > B;
+    phase_timer *timer;
+    bool open;
+    float opt_cost;
+    vector<int> tour;
+    vector<float> end_cost;
+    vector<vector<int> > end_paths;
+    string checkpoint;        // file of the completed layers, empty for none
+    int resumed;              // last layer loaded from it, 1 if none
+
+    held_karp_run(int n, float **C, phase_timer *timer, bool open = false)
+        : n(n), C(C), B(pascals_triangle(n)), timer(timer), open(open), opt_cost(FLT_MAX), resumed(1) {}
+
+    // Walk back through the table from set S ending at last, each city preceded by its cheapest predecessor
+    template <class Dist>
+    void walk_back(const Dist &G, unsigned int S, int last, vector<int> &path) {
+        path.assign(n, 0);
+        for (int pos = n - 1; pos > 0; pos--) {
+            path[pos] = last;
+            unsigned int prev = S & ~(1 << last);
+            float min_cost = FLT_MAX;
+            int opt_prev = 0;
+            for (int w = 1; w < n; w++) {
+                if (prev & (1 << w) && C[prev][w] + G(w, last) < min_cost) {
+                    min_cost = C[prev][w] + G(w, last);
+                    opt_prev = w;
+                }
+            }
+            S = prev;
+            last = opt_prev;
+        }
+    }
+
+    template <class Dist>
+    void operator()(const Dist &G) {
+        // First step of Held-Karp: compute base cases
+        for (int k = 1; k < n; k++) {
+            C[1 << k][k] = G(0, k);
+        }
+
+        layer_log log(n, C, B);
+        if (checkpoint != "") {
+            resumed = log.open(checkpoint, distance_hash(G, n));
+        }
+
+        /*  Main loop of Held-Karp: compute all subproblems via bottom-up DP
+            Outer-most loop cannot be parallelized because larger subproblems 
+            depend on smaller ones */
+        for (int p = resumed + 1; p < n; p++) {
+            // where the values go in file order too, if they are checkpointed
+            float *dump = checkpoint != "" ? log.layer_buffer(p) : NULL;
+            /*  For all S a subset of {1, 2, ..., n - 1} such that |S| = p
+                This is the loop to target for parallelism */
+            /*  Each thread's region ends when its share is done, so waiting
+                for the others at the barrier counts as idle time */
+            #pragma omp parallel
+            {
+                PERF_REGION("hk_layer");
+                /*  Every thread takes the contiguous share of the sets a
+                    static schedule would give it, unranks its first set and
+                    walks the rest with Gosper's hack, so no list of the sets
+                    is ever stored. Sets s of {0, ..., n - 2} stand for
+                    S = s << 1, which leaves out city 0 */
+                long count = B[n - 1][p];
+                int threads = omp_get_num_threads();
+                int t = omp_get_thread_num();
+                long begin = count * t / threads;
+                long end = count * (t + 1) / threads;
+                unsigned int s = unrank_subset(begin, p, n - 1, B);
+                for (long i = begin; i < end; i++, s = next_subset(s)) {
+                    unsigned int S = s << 1;
+                    float *out = dump ? dump + i * p : NULL;
+                    // For all k in S
+                    for (unsigned int k = 1; k < n; k++) {
+                        if (S & (1 << k)) {
+                            float min_cost = FLT_MAX;
+                            // For all w in S, w != k
+                            for (unsigned int w = 1; w < n; w++) {
+                                if (w != k && S & (1 << w)) {
+                                    float cost = C[S & ~(1 << k)][w] + G(w, k);
+                                    if (cost < min_cost) {
+                                        min_cost = cost;
+                                    }
+                                }
+                            }
+                            C[S][k] = min_cost;
+                            if (out) {
+                                *out++ = min_cost;
+                            }
+                        }
+                    }
+                }
+            }
+            if (checkpoint != "") {
+                log.write_async(p);
+            }
+        }
+        log.wait();
+        mark_phase(timer, PHASE_SOLVE);
+
+        unsigned int S_tour = ((1 << n) - 1) & ~1;
+        if (open) {
+            end_cost.assign(n, 0);
+            end_paths.resize(n);
+            for (int k = 1; k < n; k++) {
+                end_cost[k] = C[S_tour][k];
+                walk_back(G, S_tour, k, end_paths[k]);
+            }
+            mark_phase(timer, PHASE_RECONSTRUCT);
+            return;
+        }
+
+        // Use computed subproblems to find the optimal cost
+        opt_cost = FLT_MAX;
+        int last = 1;
+        for (int k = 1; k < n; k++) {
+            float tour_cost = C[S_tour][k] + G(k, 0);
+            if (tour_cost < opt_cost) {
+                opt_cost = tour_cost;
+                last = k;
+            }
+        }
+
+        walk_back(G, S_tour, last, tour);
+        mark_phase(timer, PHASE_RECONSTRUCT);
+    }
+};
+
+
+// Allocates the DP table, a row of n floats for every set
+float **alloc_table(int n) {
+    float **C = (float**)malloc((1 << n) * sizeof(float*));
+    for (int i = 0; i < (1 << n); i++) {
+        C[i] = (float*)malloc(n * sizeof(float));
+    }
+    return C;
+}
+
+
+void free_table(float **C, int n) {
+    for (int i = 0; i < (1 << n); i++) {
+        free(C[i]);
+    }
+    free(C);
+}
+
+
+// Returns an optimal tour of a parsed instance
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    int n = inst.n;
+    float **C = alloc_table(n);
+    mark_phase(timer, PHASE_ALLOC);
+
+    held_karp_run solver(n, C, timer);
+    solver.checkpoint = opts.checkpoint;
+    dispatch_metric(inst, solver);
+    if (opts.checkpoint != "") {
+        // the run is complete, so there is nothing left to resume
+        remove(opts.checkpoint.c_str());
+    }
+
+    // Free memory
+    free_table(C, n);
+    mark_phase(timer, PHASE_ALLOC);
+
+    tsp_result result;
+    result.cost = solver.opt_cost;
+    result.tour.swap(solver.tour);
+    result.stats.push_back(tsp_stat("table_mb", (double)(1 << n) * n * sizeof(float) / (1 << 20)));
+    if (opts.checkpoint != "") {
+        result.stats.push_back(tsp_stat("resumed_layer", solver.resumed));
+    }
+    return result;
+}
+
+
+void open_paths(const dist_data &inst, vector<float> &length, vector<vector<int> > &paths) {
+    int n = inst.n;
+    float **C = alloc_table(n);
+    held_karp_run solver(n, C, NULL, true);
+    dispatch_metric(inst, solver);
+    free_table(C, n);
+    length.swap(solver.end_cost);
+    paths.swap(solver.end_paths);
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
 int main(int argc, char *argv[]) {
     string file_name = "";
     int num_threads = omp_get_max_threads();
+    tsp_options opts;
     // Check if thread count is passed in as a command line argument
     for (int i = 0; i < argc; i++) {
         string arg(argv[i]);
@@ -45,6 +428,8 @@ int main(int argc, char *argv[]) {
             file_name = argv[i + 1];
         } else if (arg == "-t" && i + 1 < argc) {
             num_threads = atoi(argv[i + 1]);
+        } else if (arg == "-ckpt" && i + 1 < argc) {
+            opts.checkpoint = argv[i + 1];
         }
     }
     omp_set_num_threads(num_threads);
@@ -55,96 +440,20 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    n = parse_matrix(file_name, G);
-
-    // Allocate DP array
-    float **C = (float**)malloc((1 << n) * sizeof(float*));
-    for (int i = 0; i < (1 << n); i++) {
-        C[i] = (float*)malloc(n * sizeof(float));
-    }
-
-    /*  Precompute last row of Pascal's triangle for values of n choose p
-        in order to statically parallelize for loop in main computation */
-    vector<int> T = pascals_triangle(n + 1);
-
-    // Allocate array to store sets (removes sequential dependency on S in for loop)
-    unsigned int **sets = (unsigned int **)malloc(n * sizeof(unsigned int*));
-    for (int p = 2; p < n; p++) {
-        sets[p] = (unsigned int *)malloc(T[p] * sizeof(unsigned int));
-    }
-
-    /*  Fill sets array, dynamic scheduling because number of sets for
-        each size p can vary widely (Pascal's triangle) */
-    #pragma omp parallel for schedule(dynamic)
-    for (int p = 2; p < n; p++) {
-        unsigned int S = (1 << p) - 1;
-        int limit = 1 << n;
-        int i = 0;
-        while (S < limit) {
-            sets[p][i] = S;
-            i++;
-            // Compute the next set using Gosper's Hack
-            unsigned int c = S & -S;
-            unsigned int r = S + c;
-            S = (((r ^ S) >> 2) / c) | r;
-        }
-    }
-
-    // First step of Held-Karp: compute base cases
-    for (int k = 1; k < n; k++) {
-        C[1 << k][k] = G[0][k];
-    }
-
-    /*  Main loop of Held-Karp: compute all subproblems via bottom-up DP
-        Outer-most loop cannot be parallelized because larger subproblems 
-        depend on smaller ones */
-    for (int p = 2; p < n; p++) {
-        /*  For all S a subset of {1, 2, ..., n - 1} such that |S| = p
-            This is the loop to target for parallelism */
-        #pragma omp parallel for schedule(static)
-        for (int i = 0; i < T[p]; i++) {
-            unsigned int S = sets[p][i];
-            if (!(S & 1)) {
-                // For all k in S
-                for (unsigned int k = 0; k < n; k++) {
-                    if (S & (1 << k)) {
-                        float min_cost = FLT_MAX;
-                        // For all w in S, w != k
-                        for (unsigned int w = 0; w < n; w++) {
-                            if (w != k && S & (1 << w)) {
-                                float cost = C[S & ~(1 << k)][w] + G[w][k];
-                                if (cost < min_cost) {
-                                    min_cost = cost;
-                                }
-                            }
-                        }
-                        C[S][k] = min_cost;
-                    }
-                }
-            }
-        }
-        free(sets[p]);
-    }
-    free(sets);
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
 
-    // Use computed subproblems to find the optimal cost
-    float opt_cost = FLT_MAX;
-    unsigned int S_tour = ((1 << n) - 1) & ~1;
-    for (int k = 1; k < n; k++) {
-        float tour_cost = C[S_tour][k] + G[k][0];
-        if (tour_cost < opt_cost) {
-            opt_cost = tour_cost;
+    tsp_result result = held_karp_par::solve(inst, opts);
+    for (size_t i = 0; i < result.stats.size(); i++) {
+        if (result.stats[i].name == "resumed_layer" && result.stats[i].value > 1) {
+            cout << "Resumed after layer " << result.stats[i].value << endl;
         }
     }
 
     // Output optimal cost
-    cout << "Tour cost = " << opt_cost << endl;
-
-    // Free memory
-    for (int i = 0; i < (1 << n); i++) {
-        free(C[i]);
-    }
-    free(C);
+    cout << "Tour cost = " << result.cost << endl;
 
     return 0;
 }
+#endif
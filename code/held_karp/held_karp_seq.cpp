@@ -1,5 +1,5 @@
 /*  Sequential Held-Karp Algorithm for the Metric TSP Problem 
-    Input: the number of cities n followed by the full matrix of distances.
+    Input: any instance the parser reads, distances go through the shared oracle.
     Output: The cost of the optimal tour.
 */
 #include <iostream>
@@ -7,91 +7,151 @@
 #include <stdlib.h>
 #include <float.h>
 #include "../parse/parser.h"
+#include "../libtsp/tsp.h"
+#include "../common/perf.h"
 
 using namespace std;
 
+namespace held_karp_seq {
 
-// Global variables
-int n;
-vector<vector<float> > G;
+// Fills the DP table C bottom-up and keeps the optimal tour and its cost
+struct held_karp_run {
+    int n;
+    float **C;
+    phase_timer *timer;
+    float opt_cost;
+    vector<int> tour;
 
+    held_karp_run(int n, float **C, phase_timer *timer) : n(n), C(C), timer(timer), opt_cost(FLT_MAX) {}
 
-int main(int argc, char *argv[]) {
-    string file_name = "";
-    for (int i = 0; i < argc; i++) {
-        string arg(argv[i]);
-        if (arg == "-f" && i + 1 < argc) {
-            file_name = argv[i + 1];
+    template <class Dist>
+    void operator()(const Dist &G) {
+        // First step of Held-Karp: compute base cases
+        for (int k = 1; k < n; k++) {
+            C[1 << k][k] = G(0, k);
         }
-    }
 
-    if (file_name == "") {
-        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
-        return 0;
+        // Main loop of Held-Karp: compute all subproblems via bottom-up DP
+        for (int p = 2; p < n; p++) {
+            PERF_REGION("hk_layer");
+            unsigned int S = (1 << p) - 1;
+            int limit = 1 << n;
+            // For all S a subset of {1, 2, ..., n - 1} such that |S| = p
+            while (S < limit) {
+                if (!(S & 1)) {
+                    // For all k in S
+                    for (unsigned int k = 0; k < n; k++) {
+                        if (S & (1 << k)) {
+                            float min_cost = FLT_MAX;
+                            // For all w in S, w != k
+                            for (unsigned int w = 0; w < n; w++) {
+                                if (w != k && S & (1 << w)) {
+                                    float cost = C[S & ~(1 << k)][w] + G(w, k);
+                                    if (cost < min_cost) {
+                                        min_cost = cost;
+                                    }
+                                }
+                            }
+                            C[S][k] = min_cost;
+                        }
+                    }
+                }
+                // Compute the next set using Gosper's Hack
+                unsigned int c = S & -S;
+                unsigned int r = S + c;
+                S = (((r ^ S) >> 2) / c) | r;
+            }
+        }
+
+        mark_phase(timer, PHASE_SOLVE);
+
+        // Use computed subproblems to find the optimal cost
+        opt_cost = FLT_MAX;
+        unsigned int S_tour = ((1 << n) - 1) & ~1;
+        int last = 1;
+        for (int k = 1; k < n; k++) {
+            float tour_cost = C[S_tour][k] + G(k, 0);
+            if (tour_cost < opt_cost) {
+                opt_cost = tour_cost;
+                last = k;
+            }
+        }
+
+        // Walk back through the table, each city preceded by its cheapest predecessor
+        tour.assign(n, 0);
+        unsigned int S = S_tour;
+        for (int pos = n - 1; pos > 0; pos--) {
+            tour[pos] = last;
+            unsigned int prev = S & ~(1 << last);
+            float min_cost = FLT_MAX;
+            int opt_prev = 0;
+            for (int w = 1; w < n; w++) {
+                if (prev & (1 << w) && C[prev][w] + G(w, last) < min_cost) {
+                    min_cost = C[prev][w] + G(w, last);
+                    opt_prev = w;
+                }
+            }
+            S = prev;
+            last = opt_prev;
+        }
+        mark_phase(timer, PHASE_RECONSTRUCT);
     }
+};
 
-    n = parse_matrix(file_name, G);
+
+// Returns an optimal tour of a parsed instance
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    int n = inst.n;
 
     // Allocate DP array
     float **C = (float**)malloc((1 << n) * sizeof(float*));
     for (int i = 0; i < (1 << n); i++) {
         C[i] = (float*)malloc(n * sizeof(float));
     }
+    mark_phase(timer, PHASE_ALLOC);
+
+    held_karp_run solver(n, C, timer);
+    dispatch_metric(inst, solver);
 
-    // First step of Held-Karp: compute base cases
-    for (int k = 1; k < n; k++) {
-        C[1 << k][k] = G[0][k];
+    // Free memory
+    for (int i = 0; i < (1 << n); i++) {
+        free(C[i]);
     }
+    free(C);
+    mark_phase(timer, PHASE_ALLOC);
 
-    // Main loop of Held-Karp: compute all subproblems via bottom-up DP
-    for (int p = 2; p < n; p++) {
-        unsigned int S = (1 << p) - 1;
-        int limit = 1 << n;
-        // For all S a subset of {1, 2, ..., n - 1} such that |S| = p
-        while (S < limit) {
-            if (!(S & 1)) {
-                // For all k in S
-                for (unsigned int k = 0; k < n; k++) {
-                    if (S & (1 << k)) {
-                        float min_cost = FLT_MAX;
-                        // For all w in S, w != k
-                        for (unsigned int w = 0; w < n; w++) {
-                            if (w != k && S & (1 << w)) {
-                                float cost = C[S & ~(1 << k)][w] + G[w][k];
-                                if (cost < min_cost) {
-                                    min_cost = cost;
-                                }
-                            }
-                        }
-                        C[S][k] = min_cost;
-                    }
-                }
-            }
-            // Compute the next set using Gosper's Hack
-            unsigned int c = S & -S;
-            unsigned int r = S + c;
-            S = (((r ^ S) >> 2) / c) | r;
+    tsp_result result;
+    result.cost = solver.opt_cost;
+    result.tour.swap(solver.tour);
+    result.stats.push_back(tsp_stat("table_mb", (double)(1 << n) * n * sizeof(float) / (1 << 20)));
+    return result;
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
+int main(int argc, char *argv[]) {
+    string file_name = "";
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            file_name = argv[i + 1];
         }
     }
 
-    // Use computed subproblems to find the optimal cost
-    float opt_cost = FLT_MAX;
-    unsigned int S_tour = ((1 << n) - 1) & ~1;
-    for (int k = 1; k < n; k++) {
-        float tour_cost = C[S_tour][k] + G[k][0];
-        if (tour_cost < opt_cost) {
-            opt_cost = tour_cost;
-        }    
+    if (file_name == "") {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
     }
 
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
+
     // Output optimal cost
-    cout << "Tour cost = " << opt_cost << endl;
-    
-    // Free memory
-    for (int i = 0; i < (1 << n); i++) {
-        free(C[i]);
-    }
-    free(C);
-    
+    cout << "Tour cost = " << held_karp_seq::solve(inst, tsp_options()).cost << endl;
+
     return 0;
-}
\ No newline at end of file
+}
+#endif
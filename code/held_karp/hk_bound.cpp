@@ -0,0 +1,196 @@
+/*  Held-Karp 1-tree lower bound for the symmetric TSP
+    Input: any symmetric instance the parser reads.
+    Output: A lower bound on the optimal tour, printed as it improves.
+    Subgradient ascent on the node penalties of the 1-tree bound (see
+    common/one_tree.h). Below SPARSE_MIN_N cities every step builds the 1-tree
+    of the complete graph. Above it steps use the much cheaper 1-tree of the
+    candidate graph (the CANDIDATES nearest neighbours of every city plus the
+    complete graph's first 1-tree, which keeps it connected). That only bounds
+    tours inside the candidate graph, so every CERTIFY_EVERY steps (or less
+    often, see below) the best penalties so far are evaluated on the complete
+    graph, in parallel, and only those bounds are reported.
+    Alongside a solver (tsp_solve with a target gap or live gap) the engine
+    shares a bound_monitor with it: the solver's tours give the gap and both
+    stop once it reaches the target.
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "../libtsp/tsp.h"
+#include "../common/one_tree.h"
+#include "../common/perf.h"
+
+using namespace std;
+
+namespace hk_bound {
+
+const int SPARSE_MIN_N = 400;
+const int CANDIDATES = 10;
+const int CERTIFY_EVERY = 25;
+
+
+/*  The subgradient ascent, with the step schedule of Helsgaun's LKH, which
+    needs no upper bound: the step doubles while the bound keeps improving,
+    then stays fixed for a period of steps; period and step halve after each
+    period, and the period doubles again if its last step still improved.
+    Directions mix in 30% of the previous subgradient to damp oscillation */
+struct ascent {
+    int n;
+    bound_monitor &monitor;
+    int iters;
+    double best_bound;
+
+    ascent(int n, bound_monitor &monitor, int iters) : n(n), monitor(monitor), iters(iters), best_bound(0) {}
+
+    // Bound of the complete graph under pi, passed on to the monitor
+    template <class Dist>
+    void certify(const Dist &dist, const vector<double> &pi, one_tree &t) {
+        min_one_tree(dist, n, pi.data(), t);
+        if (t.bound > best_bound) {
+            best_bound = t.bound;
+            monitor.offer_lower(t.bound);
+        }
+    }
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        bool sparse = n >= SPARSE_MIN_N;
+        vector<double> pi(n, 0), best_pi(n, 0), last(n, 0);
+        one_tree t;
+        certify(dist, pi, t);
+        sparse_graph graph;
+        if (sparse) {
+            int k = min(CANDIDATES, n - 1);
+            vector<int> cand((size_t)n * k);
+            candidate_builder builder = {n, k, cand.data()};
+            builder(dist);
+            graph.init(n, cand.data(), k);
+            graph.add(dist, t);
+        }
+
+        double best = t.bound;
+        double certified = best;
+        int interval = CERTIFY_EVERY;
+        int next_certify = interval;
+        double step = 1;
+        double min_step = 1e-6 * max(1.0, fabs(best) / n);
+        int period = max(10, n / 2);
+        bool initial = true;
+        int it = 0;
+        while (step > min_step && period > 0 && it < iters && !t.is_tour()) {
+            for (int p = 1; p <= period && it < iters && !t.is_tour() && !monitor.reached(); p++, it++) {
+                PERF_REGION("hk_bound_step");
+                for (int i = 0; i < n; i++) {
+                    int g = t.degree[i] - 2;
+                    pi[i] += step * (0.7 * g + 0.3 * last[i]);
+                    last[i] = g;
+                }
+                if (sparse) {
+                    min_one_tree(graph, n, pi.data(), t);
+                } else {
+                    certify(dist, pi, t);
+                }
+                if (t.bound > best) {
+                    best = t.bound;
+                    best_pi = pi;
+                    if (initial) {
+                        step *= 2;
+                    }
+                    if (p == period) {
+                        period *= 2;
+                    }
+                } else if (initial && p > period / 2) {
+                    initial = false;
+                    p = 0;
+                    step = 3 * step / 4;
+                }
+                if (sparse && it + 1 >= next_certify && best > certified) {
+                    /*  Once the complete graph's 1-trees stop bringing new
+                        edges the two agree, so certify less and less often */
+                    one_tree full;
+                    certify(dist, best_pi, full);
+                    size_t edges = graph.adj.size();
+                    graph.add(dist, full);
+                    interval = graph.adj.size() == edges ? min(2 * interval, 32 * CERTIFY_EVERY) : CERTIFY_EVERY;
+                    next_certify = it + 1 + interval;
+                    certified = best;
+                }
+            }
+            if (monitor.reached()) {
+                break;
+            }
+            period /= 2;
+            step /= 2;
+        }
+        if (sparse) {
+            certify(dist, best_pi, t);
+        }
+    }
+};
+
+
+double run(const dist_data &inst, bound_monitor &monitor, int iters) {
+    if (inst.n < 3) {
+        return 0;
+    }
+    ascent engine(inst.n, monitor, iters > 0 ? iters : 100 * inst.n);
+    dispatch_metric(inst, engine);
+    return engine.best_bound;
+}
+
+}
+
+
+#ifndef TSP_LIBRARY
+int main(int argc, char *argv[]) {
+    string file_name = "";
+    int num_threads = omp_get_max_threads();
+    int iters = 0;
+    double target_gap = 0;
+    double upper = 0;
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            file_name = argv[i + 1];
+        } else if (arg == "-t" && i + 1 < argc) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (arg == "-i" && i + 1 < argc) {
+            iters = atoi(argv[i + 1]);
+        } else if (arg == "-u" && i + 1 < argc) {
+            upper = atof(argv[i + 1]);
+        } else if (arg == "-gap" && i + 1 < argc) {
+            target_gap = atof(argv[i + 1]);
+        }
+    }
+
+    if (file_name == "") {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
+    }
+
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
+    if (!is_symmetric(inst)) {
+        cout << "The 1-tree bound needs a symmetric instance" << endl;
+        return 1;
+    }
+
+    omp_set_num_threads(num_threads);
+    cout << "Running with " << num_threads << " threads" << endl;
+    bound_monitor monitor(target_gap, true);
+    if (upper > 0) {
+        monitor.offer_upper(upper);
+    }
+    double bound = hk_bound::run(inst, monitor, iters);
+
+    cout << "Lower bound = " << setprecision(12) << bound << endl;
+    return 0;
+}
+#endif
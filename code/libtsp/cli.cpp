@@ -0,0 +1,182 @@
+/*  Single command line front end for every solver in libtsp
+    Usage: ./tsp [-a ALGO] [-f FILES] [-l LIST_FILE] [-t THREADS] [-r RUNS]
+                 [-seed N] [-time SECONDS] [-gap TARGET] [-live] [-tour] [-s]
+                 [-profile FILE]
+      -a ALGO       hk, hk_seq, lk, gen, bb, sa, cluster or aco, or auto to pick
+                    one per instance from the cost model (default lk, with
+                    lkh kept as an alias)
+      -f FILES      comma separated instance files
+      -l LIST_FILE  file with one instance per line, added after FILES
+      -t THREADS    thread count (default all cores)
+      -r RUNS       Lin-Kernighan restarts (default depends on the size) or
+                    annealing replicas (default 8 or one per thread) or
+                    ants (default 16 or one per thread)
+      -seed N       seed of the randomized solvers (default 0)
+      -time SECONDS stop branch and bound early and report its gap, stop
+                    annealing and aco early or start no more Lin-Kernighan
+                    restarts; auto's time budget (default 10)
+      -gap TARGET   run the 1-tree lower bound alongside the solver and stop
+                    once the tour is proven within TARGET (0.01 is 1%) of
+                    the optimum; lk, gen, sa and aco stop early, the others
+                    finish
+      -live         the same without a target, printing the gap to stderr
+                    whenever the bound or the tour improves
+      -tour         include each tour in the output
+      -s            print per generation statistics of the genetic algorithm
+      -profile FILE cost model for auto (default results/profile.txt, see
+                    bench -b calibrate)
+    All instances are solved in this one process and each result is printed
+    as one line of JSON, with the time spent in every phase. With auto the
+    algorithm is the one picked, and the stats include its predicted time.
+*/
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "tsp.h"
+
+using namespace std;
+
+
+vector<string> split(string s) {
+    vector<string> parts;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos) {
+            end = s.size();
+        }
+        if (end > start) {
+            parts.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return parts;
+}
+
+
+int main(int argc, char *argv[]) {
+    string algo = "lk";
+    vector<string> instances;
+    string list_name = "";
+    tsp_options opts;
+    opts.threads = omp_get_max_threads();
+    bool with_tour = false;
+    string profile_name = "";
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-a" && i + 1 < argc) {
+            algo = argv[i + 1];
+        } else if (arg == "-f" && i + 1 < argc) {
+            vector<string> files = split(argv[i + 1]);
+            instances.insert(instances.end(), files.begin(), files.end());
+        } else if (arg == "-l" && i + 1 < argc) {
+            list_name = argv[i + 1];
+        } else if (arg == "-t" && i + 1 < argc) {
+            opts.threads = max(1, atoi(argv[i + 1]));
+        } else if (arg == "-r" && i + 1 < argc) {
+            opts.runs = atoi(argv[i + 1]);
+        } else if (arg == "-seed" && i + 1 < argc) {
+            opts.seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (arg == "-tour") {
+            with_tour = true;
+        } else if (arg == "-gap" && i + 1 < argc) {
+            opts.target_gap = atof(argv[i + 1]);
+            if (!(opts.target_gap > 0 && opts.target_gap < 1)) {
+                cout << "The gap target must be between 0 and 1" << endl;
+                return 1;
+            }
+        } else if (arg == "-live") {
+            opts.live_gap = true;
+        } else if (arg == "-time" && i + 1 < argc) {
+            opts.time_limit = atof(argv[i + 1]);
+        } else if (arg == "-s") {
+            opts.print_stats = true;
+        } else if (arg == "-profile" && i + 1 < argc) {
+            profile_name = argv[i + 1];
+        }
+    }
+
+    bool pick = algo == "auto";
+    const tsp_solver *solver = find_solver(algo);
+    if (!solver && !pick) {
+        cout << "Unknown algorithm " << algo << ", use";
+        for (size_t i = 0; i < tsp_solvers().size(); i++) {
+            cout << (i ? ", " : " ") << tsp_solvers()[i].name;
+        }
+        cout << " or auto" << endl;
+        return 0;
+    }
+    tsp_profile profile;
+    if (pick) {
+        if (profile_name == "") {
+            profile = default_profile();
+            if (profile.models.empty()) {
+                cout << "Could not find results/profile.txt, run bench -b calibrate" << endl;
+                return 1;
+            }
+        } else if (!profile.load(profile_name)) {
+            cout << "Could not read profile " << profile_name << endl;
+            return 1;
+        }
+    }
+    if (list_name != "") {
+        ifstream list(list_name);
+        if (!list) {
+            cout << "Could not open " << list_name << endl;
+            return 1;
+        }
+        string line;
+        while (getline(list, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line != "") {
+                instances.push_back(line);
+            }
+        }
+    }
+    if (instances.empty()) {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < instances.size(); i++) {
+        string path = instance_path(instances[i]);
+        if (access(path.c_str(), R_OK) != 0) {
+            printf("{\"instance\": %s, \"error\": \"could not open instance\"}\n", json_string(instances[i]).c_str());
+            failed++;
+            continue;
+        }
+
+        phase_timer timer;
+        dist_data inst;
+        parse_instance(path, inst);
+        precompute_dist_table(inst);
+        timer.mark(PHASE_PARSE);
+        tsp_choice choice = {solver, opts, 0};
+        if (pick) {
+            choice = choose_solver(profile, inst, opts, available_memory());
+        }
+        string error = choice.solver ? refusal(*choice.solver, inst) : "no solver of the profile takes the instance";
+        if (error != "") {
+            printf("{\"instance\": %s, \"error\": %s}\n", json_string(instances[i]).c_str(),
+                   json_string(error).c_str());
+            failed++;
+            continue;
+        }
+
+        tsp_result result = tsp_solve(*choice.solver, inst, choice.opts, &timer);
+        if (pick) {
+            result.stats.push_back(tsp_stat("predicted_seconds", choice.seconds));
+        }
+        printf("%s\n", result_json(instances[i], *choice.solver, inst.n, opts.threads, result, timer,
+                                   with_tour).c_str());
+        fflush(stdout);
+    }
+    return failed ? 1 : 0;
+}
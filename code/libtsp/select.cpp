@@ -0,0 +1,189 @@
+/*  Automatic solver selection from a calibrated cost model
+    bench -b calibrate runs every solver on a sweep of instances on this
+    machine and fits a solver_model per solver and kind of instance into
+    results/profile.txt, the only copy of the models: without it auto
+    refuses to pick. choose_solver predicts each solver's time on an
+    instance from it, drops the solvers that refuse the instance, would not
+    fit in memory or have no model, and among those that fit the time
+    budget picks the lowest calibrated excess over the optimum, the fastest
+    on a tie. sa, aco and bb stop at the budget, so they always fit it: sa
+    and aco are ranked by their excess anyway, and bb cut short by the
+    excess of the Lin-Kernighan tour it starts from. Exact solvers have no
+    excess, so they win whenever they finish in time. If none fits the
+    budget the fastest one runs. lk gets as many rounds of restarts (one
+    per thread) as fit in the budget.
+*/
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <omp.h>
+#include "tsp.h"
+
+using namespace std;
+
+// Budget in seconds when the options give no time limit
+const double DEFAULT_BUDGET = 10;
+// Excesses closer than this count as a tie, unless one of them is an exact solver's 0
+const double EXCESS_TIE = 0.002;
+
+
+const solver_model *tsp_profile::find(string solver, string kind) const {
+    const solver_model *other = NULL;
+    for (size_t i = 0; i < models.size(); i++) {
+        if (models[i].solver == solver) {
+            if (models[i].kind == kind) {
+                return &models[i];
+            }
+            other = &models[i];
+        }
+    }
+    return other;
+}
+
+// One model per line: solver kind scale exponent excess threads max_n, # starts a comment
+bool tsp_profile::load(string path) {
+    FILE *in = fopen(path.c_str(), "r");
+    if (!in) {
+        return false;
+    }
+    models.clear();
+    char line[256], solver[64], kind[64];
+    while (fgets(line, sizeof(line), in)) {
+        solver_model m;
+        if (line[0] != '#' && sscanf(line, "%63s %63s %lf %lf %lf %d %d", solver, kind, &m.scale, &m.exponent,
+                                     &m.excess, &m.threads, &m.max_n) == 7) {
+            m.solver = solver_name(solver);
+            m.kind = kind;
+            models.push_back(m);
+        }
+    }
+    fclose(in);
+    return !models.empty();
+}
+
+bool tsp_profile::save(string path) const {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+    fprintf(out, "# solver kind scale exponent excess threads max_n, written by bench -b calibrate\n");
+    for (size_t i = 0; i < models.size(); i++) {
+        const solver_model &m = models[i];
+        fprintf(out, "%s %s %.3g %.3g %.3g %d %d\n", m.solver.c_str(), m.kind.c_str(), m.scale, m.exponent,
+                m.excess, m.threads, m.max_n);
+    }
+    return fclose(out) == 0;
+}
+
+
+string instance_kind(const dist_data &inst) {
+    return inst.x ? "coord" : "matrix";
+}
+
+// Held-Karp keeps a row of n floats behind a pointer for every subset
+double solver_memory(string solver, int n) {
+    if (solver == "hk" || solver == "hk_seq") {
+        return ldexp(4.0 * n + 24, n);
+    }
+    return 0;
+}
+
+double predict_seconds(const solver_model &model, int n, int threads) {
+    double work = model.solver == "hk" ? ldexp((double)n * n, n) : pow(n, model.exponent);
+    return model.scale * work * model.threads / max(1, threads);
+}
+
+static tsp_profile find_profile() {
+    tsp_profile profile;
+    const char *paths[] = {"results/profile.txt", "../../results/profile.txt"};
+    for (int i = 0; i < 2; i++) {
+        if (access(paths[i], R_OK) == 0 && profile.load(paths[i])) {
+            return profile;
+        }
+    }
+    return profile;
+}
+
+// Found once, on first use, which is safe from any thread
+const tsp_profile &default_profile() {
+    static const tsp_profile profile = find_profile();
+    return profile;
+}
+
+// Solvers that return their best tour so far once opts.time_limit passes
+static bool stops_at_deadline(string solver) {
+    return solver == "sa" || solver == "aco" || solver == "bb";
+}
+
+double available_memory() {
+    return (double)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+}
+
+
+tsp_choice choose_solver(const tsp_profile &profile, const dist_data &inst, const tsp_options &opts,
+                         double memory) {
+    int threads = opts.threads > 0 ? opts.threads : omp_get_max_threads();
+    double budget = opts.time_limit > 0 ? opts.time_limit : DEFAULT_BUDGET;
+    string kind = instance_kind(inst);
+
+    tsp_choice best = {NULL, opts, 0};
+    double best_excess = 0;
+    bool best_fits = false;
+    const vector<tsp_solver> &solvers = tsp_solvers();
+    for (size_t i = 0; i < solvers.size(); i++) {
+        const solver_model *model = profile.find(solvers[i].name, kind);
+        if (!model || refusal(solvers[i], inst) != "" || solver_memory(model->solver, inst.n) > memory) {
+            continue;
+        }
+        // how soon branch and bound closes its gap depends on the instance more
+        // than on its size, so its time is not extrapolated
+        if (model->solver == "bb" && inst.n > model->max_n) {
+            continue;
+        }
+        tsp_choice c = {&solvers[i], opts, predict_seconds(*model, inst.n, threads)};
+        if (model->solver == "lk") {
+            // default restarts, or fewer rounds of one per thread if they do not fit
+            int runs = opts.runs;
+            if (runs == 0) {
+                int rounds = (lin_kern::default_runs(inst.n, threads) + threads - 1) / threads;
+                if (opts.time_limit > 0) {
+                    rounds = max(1, min(rounds, (int)(budget / (c.seconds * threads))));
+                }
+                runs = rounds * threads;
+            }
+            c.opts.runs = runs;
+            c.seconds *= runs;
+        }
+
+        double excess = model->excess;
+        bool fits = c.seconds <= budget;
+        if (!fits && stops_at_deadline(model->solver)) {
+            const solver_model *lk = profile.find("lk", kind);
+            if (model->solver == "bb" && !lk) {
+                continue;
+            }
+            // branch and bound cut short returns at worst its Lin-Kernighan incumbent
+            excess = model->solver == "bb" ? lk->excess : excess;
+            c.opts.time_limit = budget;
+            c.seconds = budget;
+            fits = true;
+        }
+        bool better;
+        if (!best.solver || fits != best_fits) {
+            better = !best.solver || fits;
+        } else if (fits && excess != best_excess &&
+                   (min(excess, best_excess) == 0 || fabs(excess - best_excess) > EXCESS_TIE)) {
+            better = excess < best_excess;
+        } else {
+            better = c.seconds < best.seconds;
+        }
+        if (better) {
+            best = c;
+            best_excess = excess;
+            best_fits = fits;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,169 @@
+/*  Solver registry and shared helpers of libtsp
+    All solvers run on the OpenMP runtime's thread pool, which lives for the
+    whole process: tsp_solve only changes how many of its threads the next
+    parallel regions use, so solving many instances in one process creates
+    the threads once.
+*/
+#include <string>
+#include <vector>
+#include <thread>
+#include <stdio.h>
+#include <omp.h>
+#include "tsp.h"
+
+using namespace std;
+
+
+const vector<tsp_solver> &tsp_solvers() {
+    static const vector<tsp_solver> solvers = {
+        {"hk", "parallel Held-Karp, exact", 30, false, held_karp_par::solve},
+        {"hk_seq", "sequential Held-Karp, exact", 30, false, held_karp_seq::solve},
+        {"lk", "Lin-Kernighan with random restarts", 1 << 30, false, lin_kern::solve},
+        {"gen", "genetic algorithm", 500, false, genetic::solve},
+        {"bb", "parallel branch and bound with 1-tree bounds, exact", 200, true, branch_bound::solve},
+        {"sa", "parallel tempering simulated annealing", 1 << 30, true, annealing::solve},
+        {"cluster", "exact Held-Karp paths through clusters, polished by Lin-Kernighan", 1 << 30, true,
+         cluster::solve},
+        {"aco", "MAX-MIN ant system over candidate lists", 1 << 30, true, aco::solve}
+    };
+    return solvers;
+}
+
+string solver_name(string name) {
+    return name == "lkh" ? "lk" : name;
+}
+
+// Returns the solver with the given name or alias, or NULL if there is none
+const tsp_solver *find_solver(string name) {
+    name = solver_name(name);
+    const vector<tsp_solver> &solvers = tsp_solvers();
+    for (size_t i = 0; i < solvers.size(); i++) {
+        if (name == solvers[i].name) {
+            return &solvers[i];
+        }
+    }
+    return NULL;
+}
+
+// Sums the edges of a tour with the instance's oracle
+struct tour_summer {
+    const int *order;
+    int n;
+    double length;
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        length = tour_length_order(dist, order, n);
+    }
+};
+
+double tour_cost(const dist_data &inst, const vector<int> &tour) {
+    if ((int)tour.size() != inst.n) {
+        return -1;
+    }
+    vector<char> seen(inst.n, 0);
+    for (size_t i = 0; i < tour.size(); i++) {
+        if (tour[i] < 0 || tour[i] >= inst.n || seen[tour[i]]) {
+            return -1;
+        }
+        seen[tour[i]] = 1;
+    }
+    tour_summer summer = {tour.data(), inst.n, 0};
+    dispatch_metric(inst, summer);
+    return summer.length;
+}
+
+string refusal(const tsp_solver &solver, const dist_data &inst) {
+    if (inst.n > solver.max_n) {
+        return string(solver.name) + " takes at most " + to_string(solver.max_n) + " vertices";
+    }
+    if (solver.symmetric_only && !is_symmetric(inst)) {
+        return string(solver.name) + " needs a symmetric instance";
+    }
+    return "";
+}
+
+/*  With a target or live gap on a symmetric instance, the 1-tree bound runs
+    on its own thread next to the solver, with a quarter of its threads, until
+    the solver returns; the bound and the gap of the tour are added to the
+    statistics */
+tsp_result tsp_solve(const tsp_solver &solver, const dist_data &inst, const tsp_options &opts,
+                     phase_timer *timer) {
+    if (opts.threads > 0) {
+        omp_set_num_threads(opts.threads);
+    }
+    if ((opts.target_gap <= 0 && !opts.live_gap) || !is_symmetric(inst)) {
+        return solver.solve(inst, opts, timer);
+    }
+
+    bound_monitor monitor(opts.target_gap, opts.live_gap);
+    tsp_options watched = opts;
+    watched.monitor = &monitor;
+    int bound_threads = max(1, omp_get_max_threads() / 4);
+    thread engine([&]() {
+        omp_set_num_threads(bound_threads);
+        hk_bound::run(inst, monitor);
+    });
+    tsp_result result = solver.solve(inst, watched, timer);
+    monitor.offer_upper(result.cost);
+    monitor.done = true;
+    engine.join();
+
+    double lower = monitor.lower.load();
+    result.stats.push_back(tsp_stat("lower_bound", lower));
+    result.stats.push_back(tsp_stat("gap", result.cost > 0 && lower > 0 ? (result.cost - lower) / result.cost : 1));
+    return result;
+}
+
+
+// Quotes a string for JSON output
+string json_string(string s) {
+    string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// One result as a single line JSON object
+string result_json(string instance, const tsp_solver &solver, int n, int threads,
+                   const tsp_result &result, const phase_timer &timer, bool with_tour) {
+    char buf[128];
+    string out = "{\"instance\": " + json_string(instance) + ", \"algorithm\": " + json_string(solver.name);
+    snprintf(buf, sizeof(buf), ", \"n\": %d, \"threads\": %d, \"cost\": %.12g", n, threads, result.cost);
+    out += buf;
+
+    out += ", \"timings\": {";
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        snprintf(buf, sizeof(buf), "\"%s\": %.9f, ", phase_names[p], timer.seconds[p]);
+        out += buf;
+    }
+    snprintf(buf, sizeof(buf), "\"total\": %.9f}", timer.total());
+    out += buf;
+
+    out += ", \"stats\": {";
+    for (size_t i = 0; i < result.stats.size(); i++) {
+        snprintf(buf, sizeof(buf), "%s: %.12g", json_string(result.stats[i].name).c_str(), result.stats[i].value);
+        out += (i ? ", " : "") + string(buf);
+    }
+    out += "}";
+
+    if (with_tour) {
+        out += ", \"tour\": [";
+        for (size_t i = 0; i < result.tour.size(); i++) {
+            out += (i ? ", " : "") + to_string(result.tour[i]);
+        }
+        out += "]";
+    }
+    return out + "}";
+}
@@ -0,0 +1,257 @@
+/*  libtsp: one interface over all the solvers
+    A solver takes a parsed instance (with its distance table precomputed) and
+    options, and returns a tour, its cost and a few solver specific statistics.
+    Solvers keep no state between calls, so one process can solve any number of
+    instances. Each solver file still builds its own command line program, and
+    compiling it with -DTSP_LIBRARY leaves only its solve function; the
+    Makefile in this directory links them all into libtsp.a.
+*/
+#ifndef TSP_H
+#define TSP_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include "../common/dist.h"
+#include "../common/timing.h"
+
+/*  Live optimality gap of one solve
+    The lower bound engine raises lower while the solver lowers upper, and
+    both stop once the gap falls below the target or done is set */
+struct bound_monitor {
+    std::atomic<double> lower;
+    std::atomic<double> upper;
+    std::atomic<bool> done;
+    double target_gap;        // 0 never stops early
+    bool verbose;             // print improvements to stderr
+    double start;
+    std::mutex print_lock;
+    double printed_lower;     // last values printed, under print_lock
+    double printed_upper;
+
+    bound_monitor(double target_gap, bool verbose)
+        : lower(0), upper(1e300), done(false), target_gap(target_gap), verbose(verbose), start(wall_time()),
+          printed_lower(0), printed_upper(1e300) {}
+
+    // (upper - lower) / upper, 1 until both sides are known
+    double gap() const {
+        double u = upper.load(), l = lower.load();
+        return u < 1e300 && l > 0 ? std::max(0.0, (u - l) / u) : 1;
+    }
+
+    bool reached() const {
+        return done || (target_gap > 0 && gap() <= target_gap);
+    }
+
+    void offer_lower(double bound) {
+        double old = lower.load();
+        while (bound > old) {
+            if (lower.compare_exchange_weak(old, bound)) {
+                report();
+                return;
+            }
+        }
+    }
+
+    void offer_upper(double cost) {
+        double old = upper.load();
+        while (cost < old) {
+            if (upper.compare_exchange_weak(old, cost)) {
+                report();
+                return;
+            }
+        }
+    }
+
+    // Prints a new tour, or a bound at least 0.01% above the last one printed
+    void report() {
+        if (!verbose) {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(print_lock);
+        double u = upper.load(), l = lower.load();
+        if (u == printed_upper && l < printed_lower * 1.0001) {
+            return;
+        }
+        printed_lower = l;
+        printed_upper = u;
+        fprintf(stderr, "gap: %.3f s: lower = %.12g", wall_time() - start, l);
+        if (u < 1e300) {
+            fprintf(stderr, ", upper = %.12g, gap = %.4f%%", u, 100 * gap());
+        }
+        fprintf(stderr, "\n");
+    }
+};
+
+struct tsp_options {
+    int threads;              // 0 keeps the current OpenMP setting
+    unsigned long long seed;
+    int runs;                 // Lin-Kernighan restarts, annealing replicas or ants, 0 picks a default
+    bool print_stats;         // per generation statistics of the genetic algorithm
+    double time_limit;        // seconds, 0 for none; branch and bound then reports its gap
+    double target_gap;        // stop once the proven gap is below it, 0 for never
+    bool live_gap;            // print the gap to stderr as the bound and the tour improve
+    bound_monitor *monitor;   // set by tsp_solve when either of the above is
+    std::string checkpoint;   // Held-Karp checkpoint file, empty for none
+
+    tsp_options() : threads(0), seed(0), runs(0), print_stats(false), time_limit(0), target_gap(0),
+                    live_gap(false), monitor(NULL) {}
+};
+
+struct tsp_stat {
+    std::string name;
+    double value;
+
+    tsp_stat(std::string name, double value) : name(name), value(value) {}
+};
+
+struct tsp_result {
+    double cost;
+    std::vector<int> tour;    // cities in visiting order, starting at city 0
+    std::vector<tsp_stat> stats;
+};
+
+typedef tsp_result (*tsp_solve_fn)(const dist_data &inst, const tsp_options &opts, phase_timer *timer);
+
+struct tsp_solver {
+    const char *name;
+    const char *description;
+    int max_n;                // largest instance it accepts
+    bool symmetric_only;
+    tsp_solve_fn solve;
+};
+
+namespace held_karp_seq {
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+}
+
+namespace held_karp_par {
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+    /*  Shortest paths from city 0 through all cities of a small instance:
+        length[k] and paths[k], in visiting order, for the path ending at k */
+    void open_paths(const dist_data &inst, std::vector<float> &length, std::vector<std::vector<int> > &paths);
+}
+
+namespace hk_bound {
+    /*  Raises monitor.lower with the Held-Karp 1-tree bound of a symmetric
+        instance until the monitor is done or reached, the ascent converges or
+        'iters' steps are taken (0 picks a default). Returns the best bound */
+    double run(const dist_data &inst, bound_monitor &monitor, int iters = 0);
+}
+
+namespace lin_kern {
+    // Number of random restarts used when none is given
+    int default_runs(int n, int max_threads);
+    /*  Shortens a tour given in visiting order with Lin-Kernighan passes,
+        starting from it instead of a random tour, then retries from up to
+        'kicks' double-bridge perturbations of the best tour, starting none
+        after 'deadline' (a wall_time(), 0 for none). Returns the new cost */
+    double improve(const dist_data &inst, std::vector<int> &order, int kicks = 0,
+                   unsigned long long seed = 0, double deadline = 0);
+    /*  Warm start after a small change: inserts the cities of inst missing from
+        'order' where they are cheapest, then runs Lin-Kernighan moves only
+        around them, the given dirty cities and wherever the moves spread.
+        Returns the new cost, and the number of improving moves in 'moves' */
+    double reoptimize(const dist_data &inst, std::vector<int> &order, const std::vector<int> &dirty,
+                      int *moves = NULL);
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+}
+
+namespace genetic {
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+}
+
+namespace branch_bound {
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+}
+
+namespace cluster {
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+}
+
+namespace annealing {
+    // Number of tempering replicas used when none is given
+    int default_replicas(int max_threads);
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+}
+
+namespace aco {
+    // Number of ants used when none is given
+    int default_ants(int max_threads);
+    tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer = NULL);
+}
+
+// Rotates a tour given in visiting order so it starts at city 0
+inline void normalize_tour(std::vector<int> &tour) {
+    for (size_t i = 0; i < tour.size(); i++) {
+        if (tour[i] == 0) {
+            std::rotate(tour.begin(), tour.begin() + i, tour.end());
+            return;
+        }
+    }
+}
+
+/*  Length of a tour given in visiting order, recomputed from the instance,
+    or -1 if the tour does not visit every city exactly once */
+double tour_cost(const dist_data &inst, const std::vector<int> &tour);
+
+/*  Calibrated cost model of one solver on one kind of instance, fitted by
+    bench -b calibrate: the solve takes scale * work(n) seconds with the
+    calibration's thread count, and proportionally less with more threads.
+    work(n) is n^2 2^n for Held-Karp and n^exponent for the others; for lk
+    the seconds are those of one restart, spread over the threads */
+struct solver_model {
+    std::string solver;
+    std::string kind;         // "coord" or "matrix"
+    double scale;
+    double exponent;
+    double excess;            // mean cost above the optimum when calibrated, 0 for exact solvers
+    int threads;
+    int max_n;                // largest instance calibrated on
+};
+
+struct tsp_profile {
+    std::vector<solver_model> models;
+
+    // The model of a solver for a kind of instance, or of another kind if there is none
+    const solver_model *find(std::string solver, std::string kind) const;
+    bool load(std::string path);
+    bool save(std::string path) const;
+};
+
+// A solver picked by choose_solver, with the options to run it with
+struct tsp_choice {
+    const tsp_solver *solver;
+    tsp_options opts;
+    double seconds;           // predicted solve time
+};
+
+std::string instance_kind(const dist_data &inst);
+// Bytes a solver allocates beyond the instance, 0 where that is negligible
+double solver_memory(std::string solver, int n);
+double predict_seconds(const solver_model &model, int n, int threads);
+// results/profile.txt if it can be found, like instance_path, else a profile without models
+const tsp_profile &default_profile();
+/*  Picks the solver the profile predicts to give the best tour within
+    opts.time_limit (DEFAULT_BUDGET seconds if 0) and 'memory' bytes, see
+    select.cpp */
+tsp_choice choose_solver(const tsp_profile &profile, const dist_data &inst, const tsp_options &opts,
+                         double memory);
+double available_memory();
+
+const std::vector<tsp_solver> &tsp_solvers();
+// Maps lkh, the name Lin-Kernighan was registered under before, to lk
+std::string solver_name(std::string name);
+const tsp_solver *find_solver(std::string name);
+// Why the solver cannot take an instance, or an empty string if it can
+std::string refusal(const tsp_solver &solver, const dist_data &inst);
+tsp_result tsp_solve(const tsp_solver &solver, const dist_data &inst, const tsp_options &opts,
+                     phase_timer *timer = NULL);
+std::string json_string(std::string s);
+std::string result_json(std::string instance, const tsp_solver &solver, int n, int threads,
+                        const tsp_result &result, const phase_timer &timer, bool with_tour);
+
+#endif
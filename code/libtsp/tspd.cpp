@@ -0,0 +1,473 @@
+/*  Persistent solver daemon on a Unix domain socket
+    Usage: ./tspd [-u SOCKET] [-w WORKERS] [-c CACHE] [-m MEGABYTES]
+      -u SOCKET    path of the socket (default /tmp/tspd.sock)
+      -w WORKERS   requests solved at the same time (default number of cores)
+      -c CACHE     parsed instances kept in memory (default 64, 0 for no limit)
+      -m MEGABYTES largest inline instance accepted (default 64)
+    Every request is one line of space separated key=value fields:
+      algo=lk file=st70.tsp threads=4 seed=1 runs=10 tour=1 id=7
+    algo is one of the libtsp solvers, or auto to let the cost model of
+    results/profile.txt pick one (see select.cpp), and file is resolved like
+    the -f option of the solvers; text instances, binary .tspb instances and
+    binary caches all work, and each is parsed once and kept with its
+    distance table. An instance can also be sent inline: bytes=N (with
+    format=mat for a matrix, TSPLIB otherwise) is followed by exactly N bytes
+    of instance text, at most -m megabytes of it. A request line longer than
+    4096 bytes gets an error and the connection is closed.
+    threads defaults to all cores, seed to 0 and runs to the solver's choice;
+    time=SECONDS limits branch and bound, annealing, aco and the restarts of
+    lk and is auto's time budget, and gap=TARGET stops lk, gen, sa and aco once the 1-tree
+    lower bound proves their tour within TARGET of optimal.
+    Each answer is one JSON line as printed by the tsp program, plus the id,
+    the seconds the request waited for a worker and for cores, and whether
+    the instance came from the cache. A connection can send many requests;
+    their answers are written as soon as they finish, so they may arrive out
+    of order.
+    Workers take requests round robin over connections, so one busy client
+    cannot starve the others, and cores are handed out in arrival order, each
+    request getting as many of the free cores as it asks for. Workers are long
+    lived threads, so each keeps its OpenMP team and malloc arena warm between
+    requests. With many concurrent requests, run with OMP_WAIT_POLICY=passive
+    so idle OpenMP threads do not spin on cores other requests could use.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <omp.h>
+#include "../parse/parser.h"
+#include "tsp.h"
+
+using namespace std;
+
+// Largest inline instance accepted by default, in megabytes
+#define MAX_INLINE_MEGABYTES 64
+// Longest request line, in bytes; a connection sending a longer one is dropped
+#define MAX_LINE_BYTES 4096
+
+
+struct request {
+    string id;
+    string algo;
+    string file;
+    string data;              // inline instance text
+    bool matrix;
+    bool with_tour;
+    tsp_options opts;
+    double queued;            // wall_time() when it entered the queue
+
+    request() : matrix(false), with_tour(false), queued(0) {}
+};
+
+// One client; the scheduler lock guards its queue, write_lock its socket
+struct connection {
+    int fd;
+    mutex write_lock;
+    deque<request> queue;
+
+    connection(int fd) : fd(fd) {}
+
+    ~connection() {
+        close(fd);
+    }
+
+    void send_line(string line) {
+        line += '\n';
+        lock_guard<mutex> guard(write_lock);
+        size_t sent = 0;
+        while (sent < line.size()) {
+            ssize_t k = send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+            if (k < 0 && errno == EINTR) {
+                continue;
+            }
+            if (k <= 0) {
+                return;
+            }
+            sent += k;
+        }
+    }
+};
+
+// Queued requests, taken round robin over the connections that have any
+struct scheduler {
+    mutex lock;
+    condition_variable ready_cv;
+    deque<shared_ptr<connection> > ready;
+
+    void add(shared_ptr<connection> c, request &r) {
+        lock_guard<mutex> guard(lock);
+        r.queued = wall_time();
+        if (c->queue.empty()) {
+            ready.push_back(c);
+        }
+        c->queue.push_back(r);
+        ready_cv.notify_one();
+    }
+
+    shared_ptr<connection> next(request &r) {
+        unique_lock<mutex> guard(lock);
+        ready_cv.wait(guard, [this] { return !ready.empty(); });
+        shared_ptr<connection> c = ready.front();
+        ready.pop_front();
+        r = c->queue.front();
+        c->queue.pop_front();
+        if (!c->queue.empty()) {
+            ready.push_back(c);
+        }
+        return c;
+    }
+};
+
+// Hands out cores to requests in the order they ask, at least one each
+struct core_budget {
+    mutex lock;
+    condition_variable cv;
+    int free;
+    unsigned long long next_ticket;
+    unsigned long long serving;
+
+    core_budget(int cores) : free(cores), next_ticket(0), serving(0) {}
+
+    int acquire(int want) {
+        unique_lock<mutex> guard(lock);
+        unsigned long long ticket = next_ticket++;
+        cv.wait(guard, [&] { return serving == ticket && free > 0; });
+        int got = min(want, free);
+        free -= got;
+        serving++;
+        cv.notify_all();
+        return got;
+    }
+
+    void release(int cores) {
+        lock_guard<mutex> guard(lock);
+        free += cores;
+        cv.notify_all();
+    }
+};
+
+// Parsed instances with their distance tables, least recently used dropped first
+struct instance_cache {
+    struct entry {
+        shared_ptr<const dist_data> inst;
+        time_t mtime;
+        list<string>::iterator age;
+    };
+
+    mutex lock;
+    size_t capacity;
+    list<string> order;
+    map<string, entry> entries;
+
+    instance_cache(size_t capacity) : capacity(capacity) {}
+
+    // Returns the instance at path, or NULL if it cannot be read
+    shared_ptr<const dist_data> get(string path, bool &hit) {
+        struct stat st;
+        hit = false;
+        if (stat(path.c_str(), &st) != 0) {
+            return NULL;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            auto it = entries.find(path);
+            if (it != entries.end() && it->second.mtime == st.st_mtime) {
+                order.splice(order.begin(), order, it->second.age);
+                hit = true;
+                return it->second.inst;
+            }
+        }
+
+        // Parse outside the lock, two requests for a new instance may both parse it
+        shared_ptr<dist_data> inst = make_shared<dist_data>();
+        if (try_parse_instance(path, *inst) < 0) {
+            return NULL;
+        }
+        precompute_dist_table(*inst);
+
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(path);
+        if (it != entries.end()) {
+            order.erase(it->second.age);
+            entries.erase(it);
+        }
+        order.push_front(path);
+        entries[path] = {inst, st.st_mtime, order.begin()};
+        if (capacity > 0 && entries.size() > capacity) {
+            entries.erase(order.back());
+            order.pop_back();
+        }
+        return inst;
+    }
+};
+
+
+int total_cores = omp_get_num_procs();
+string socket_path = "/tmp/tspd.sock";
+unsigned long long max_inline_bytes = (unsigned long long)MAX_INLINE_MEGABYTES << 20;
+
+
+string error_json(string id, string error) {
+    return "{\"id\": " + json_string(id) + ", \"error\": " + json_string(error) + "}";
+}
+
+// Fills r from one request line and returns an error message, or "" if it is valid
+string parse_request(string line, request &r, unsigned long long &bytes) {
+    bytes = 0;
+    size_t start = 0;
+    while (start < line.size()) {
+        size_t end = line.find_first_of(" \t\r", start);
+        if (end == string::npos) {
+            end = line.size();
+        }
+        string field = line.substr(start, end - start);
+        start = end + 1;
+        if (field == "") {
+            continue;
+        }
+        size_t eq = field.find('=');
+        if (eq == string::npos) {
+            return "expected key=value, got " + field;
+        }
+        string key = field.substr(0, eq), value = field.substr(eq + 1);
+        if (key == "id") {
+            r.id = value;
+        } else if (key == "algo") {
+            r.algo = value;
+        } else if (key == "file") {
+            r.file = value;
+        } else if (key == "bytes") {
+            bytes = strtoull(value.c_str(), NULL, 10);
+        } else if (key == "format") {
+            r.matrix = value == "mat";
+        } else if (key == "threads") {
+            r.opts.threads = atoi(value.c_str());
+        } else if (key == "seed") {
+            r.opts.seed = strtoull(value.c_str(), NULL, 10);
+        } else if (key == "runs") {
+            r.opts.runs = atoi(value.c_str());
+        } else if (key == "time") {
+            r.opts.time_limit = atof(value.c_str());
+        } else if (key == "gap") {
+            r.opts.target_gap = atof(value.c_str());
+            if (!(r.opts.target_gap > 0 && r.opts.target_gap < 1)) {
+                return "gap must be between 0 and 1";
+            }
+        } else if (key == "tour") {
+            r.with_tour = value == "1";
+        } else {
+            return "unknown key " + key;
+        }
+    }
+    if (bytes > max_inline_bytes) {
+        return "inline instance too large";
+    }
+    if (!find_solver(r.algo) && r.algo != "auto") {
+        return "unknown algorithm " + r.algo;
+    }
+    if (r.file == "" && bytes == 0) {
+        return "no instance, give file= or bytes=";
+    }
+    return "";
+}
+
+// Solves one request and returns its answer
+string run_request(request &r, core_budget &cores, instance_cache &cache) {
+    double wait = wall_time() - r.queued;
+    const tsp_solver *solver = find_solver(r.algo);
+
+    phase_timer timer;
+    shared_ptr<const dist_data> inst;
+    bool hit = false;
+    if (r.file != "") {
+        inst = cache.get(instance_path(r.file), hit);
+    } else {
+        shared_ptr<dist_data> parsed = make_shared<dist_data>();
+        if (parse_instance_text(r.data.data(), r.data.data() + r.data.size(), r.matrix, *parsed) >= 0) {
+            precompute_dist_table(*parsed);
+            inst = parsed;
+        }
+        string().swap(r.data);
+    }
+    if (!inst) {
+        return error_json(r.id, "could not read instance");
+    }
+    tsp_options opts = r.opts;
+    opts.print_stats = false;
+    opts.threads = opts.threads > 0 ? opts.threads : total_cores;
+    double predicted = 0;
+    if (!solver) {
+        if (default_profile().models.empty()) {
+            return error_json(r.id, "no results/profile.txt for auto, run bench -b calibrate");
+        }
+        tsp_choice choice = choose_solver(default_profile(), *inst, opts, available_memory());
+        if (!choice.solver) {
+            return error_json(r.id, "no solver of the profile takes the instance");
+        }
+        solver = choice.solver;
+        opts = choice.opts;
+        predicted = choice.seconds;
+    }
+    string error = refusal(*solver, *inst);
+    if (error != "") {
+        return error_json(r.id, error);
+    }
+    timer.mark(PHASE_PARSE);
+
+    opts.threads = cores.acquire(opts.threads);
+    wait += timer.skip();
+    tsp_result result = tsp_solve(*solver, *inst, opts, &timer);
+    cores.release(opts.threads);
+    if (predicted > 0) {
+        result.stats.push_back(tsp_stat("predicted_seconds", predicted));
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), ", \"wait\": %.9f, \"cached\": %s, ", wait, hit ? "true" : "false");
+    string json = result_json(r.file != "" ? r.file : "inline", *solver, inst->n, opts.threads, result, timer, r.with_tour);
+    return "{\"id\": " + json_string(r.id) + buf + json.substr(1);
+}
+
+void worker(scheduler &s, core_budget &cores, instance_cache &cache) {
+    while (true) {
+        request r;
+        shared_ptr<connection> c = s.next(r);
+        c->send_line(run_request(r, cores, cache));
+    }
+}
+
+// Reads requests from one client until it closes its end
+void read_requests(shared_ptr<connection> c, scheduler &s) {
+    string buf;
+    vector<char> chunk(1 << 16);
+    auto fill = [&]() {
+        ssize_t k;
+        do {
+            k = read(c->fd, chunk.data(), chunk.size());
+        } while (k < 0 && errno == EINTR);
+        if (k <= 0) {
+            return false;
+        }
+        buf.append(chunk.data(), k);
+        return true;
+    };
+
+    while (true) {
+        size_t eol;
+        while ((eol = buf.find('\n')) == string::npos && buf.size() <= MAX_LINE_BYTES) {
+            if (!fill()) {
+                return;
+            }
+        }
+        if (eol == string::npos || eol > MAX_LINE_BYTES) {
+            c->send_line(error_json("", "request line longer than " + to_string(MAX_LINE_BYTES) + " bytes"));
+            return;
+        }
+        string line = buf.substr(0, eol);
+        buf.erase(0, eol + 1);
+        if (line.find_first_not_of(" \t\r") == string::npos) {
+            continue;
+        }
+
+        request r;
+        unsigned long long bytes;
+        string error = parse_request(line, r, bytes);
+        if (error != "") {
+            c->send_line(error_json(r.id, error));
+            // the inline text cannot be told apart from requests, so stop here
+            if (bytes > 0) {
+                return;
+            }
+            continue;
+        }
+        if (bytes > 0) {
+            while (buf.size() < bytes) {
+                if (!fill()) {
+                    return;
+                }
+            }
+            r.data = buf.substr(0, bytes);
+            buf.erase(0, bytes);
+        }
+        s.add(c, r);
+    }
+}
+
+void on_signal(int) {
+    unlink(socket_path.c_str());
+    _exit(0);
+}
+
+
+int main(int argc, char *argv[]) {
+    int workers = total_cores;
+    size_t cache_size = 64;
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-u" && i + 1 < argc) {
+            socket_path = argv[i + 1];
+        } else if (arg == "-w" && i + 1 < argc) {
+            workers = max(1, atoi(argv[i + 1]));
+        } else if (arg == "-c" && i + 1 < argc) {
+            cache_size = atoi(argv[i + 1]);
+        } else if (arg == "-m" && i + 1 < argc) {
+            max_inline_bytes = strtoull(argv[i + 1], NULL, 10) << 20;
+        }
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        cout << "Socket path " << socket_path << " is too long" << endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        cout << "Could not listen on " << socket_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    static scheduler s;
+    static core_budget cores(total_cores);
+    static instance_cache cache(cache_size);
+    for (int i = 0; i < workers; i++) {
+        thread(worker, ref(s), ref(cores), ref(cache)).detach();
+    }
+    cout << "Listening on " << socket_path << " with " << workers << " workers and "
+         << total_cores << " cores" << endl;
+
+    while (true) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            cout << "accept failed: " << strerror(errno) << endl;
+            break;
+        }
+        thread(read_requests, make_shared<connection>(client), ref(s)).detach();
+    }
+    unlink(socket_path.c_str());
+    return 1;
+}
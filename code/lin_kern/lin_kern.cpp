@@ -5,38 +5,22 @@
 #include <vector>
 #include <set>
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
-#include <random>
 #include <stdlib.h>
 #include <float.h>
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 #include <omp.h>
 #include "../parse/parser.h"
+#include "../common/rng.h"
+#include "../libtsp/tsp.h"
+#include "../common/perf.h"
 
 using namespace std;
 
-
-// Global variables
-bool is_matrix;
-int n;
-vector<vector<float> > G;
-vector<float> X, Y;
-
-
-
-// Returns the distance from node i to node j
-float dist(int i, int j) {
-    if (is_matrix) {
-        return G[i][j];
-    } else {
-        int dx = X[i] - X[j];
-        int dy = Y[i] - Y[j];
-        // Round to be consistent with official TSPLIB solutions
-        return (int)(sqrt(dx * dx + dy * dy) + 0.5);
-    }
-}
-
+namespace lin_kern {
 
 // Returns the sorted edge between nodes i and j
 pair<int, int> make_edge(int i, int j) {
@@ -49,14 +33,9 @@ pair<int, int> make_edge(int i, int j) {
 
 
 // Returns the total distance of tour
-int get_tour_dist(vector<int> &tour) {
-    int currentIndex = 0;
-    double distance = 0;
-    for (int i = 0; i < n; i++) {
-        distance += dist(i, tour[i]);
-    }
-
-    return distance;
+template <class Dist>
+int get_tour_dist(const Dist &dist, vector<int> &tour) {
+    return tour_length_next(dist, tour.data(), tour.size());
 }
 
 
@@ -82,12 +61,16 @@ bool is_tour(vector<int> &tour) {
         start = tour[start];
         count++;
     }
-    return (count == n);
+    return (count == tour.size());
 }
 
 
-// A single step of Lin-Kernighan
-void lk_move(int tour_start, vector<int> &tour) {
+/*  A single step of Lin-Kernighan, returning whether it shortened the tour
+    If so and 'touched' is given, the cities at the ends of every edge the step
+    broke or joined are appended to it, a superset of those whose tour
+    neighbours changed */
+template <class Dist>
+bool lk_move(const Dist &dist, int tour_start, vector<int> &tour, vector<int> *touched = NULL) {
     set<pair<int, int> > broken_set, joined_set;
     vector<int> tour_opt = tour;
     double g_opt = 0;
@@ -102,9 +85,9 @@ void lk_move(int tour_start, vector<int> &tour) {
     double y_opt_length;
     double broken_edge_length;
     double g_opt_local;
+    size_t opt_touched = touched ? touched->size() : 0;
 
     from_v = tour[last_next_v];
-    long init_tour_dist = get_tour_dist(tour);
 
     do {
         next_v = -1;
@@ -139,6 +122,11 @@ void lk_move(int tour_start, vector<int> &tour) {
         if (next_v != -1) {
             broken_set.insert(broken_edge);
             joined_set.insert(make_edge(from_v, next_v));
+            if (touched) {
+                touched->push_back(last_next_v);
+                touched->push_back(from_v);
+                touched->push_back(next_v);
+            }
 
             y_opt_length = dist(from_v, tour_start);
             g_opt_local = g + (broken_edge_length - y_opt_length);
@@ -147,6 +135,10 @@ void lk_move(int tour_start, vector<int> &tour) {
                 g_opt = g_opt_local;
                 tour_opt = tour;
                 tour_opt[tour_start] = from_v;
+                if (touched) {
+                    touched->push_back(tour_start);
+                    opt_touched = touched->size();
+                }
             }
 
             g += broken_edge_length - dist(from_v, next_v);
@@ -159,54 +151,425 @@ void lk_move(int tour_start, vector<int> &tour) {
     } while (next_v != -1);
 
     tour = tour_opt;
-    long distance_after = get_tour_dist(tour);
-    //assert(distance_after <= init_tour_dist);
+    if (touched) {
+        touched->resize(opt_touched);
+    }
+    return g_opt > 0;
 }
 
 
-/* A single run of the Lin-Kernighan algorithm with a random initial tour
+/*  Lin-Kernighan passes over a tour until one no longer shortens it
     A tour is represented as an vector such that at city i, the next city to
-    travel to is tour[i] */
-int lin_kernighan(int seed) {
+    travel to is tour[i], and the final tour is left in 'tour' */
+template <class Dist>
+int lk_optimize(const Dist &dist, int n, vector<int> &tour) {
     int diff;
     int old_dist = 0;
     int new_dist = 0;
 
+    for (int j = 0; j < 100; j++) {
+        {
+            PERF_REGION("lk_pass");
+            for (int i = 0; i < n; i++) {
+                lk_move(dist, i, tour);
+            }
+        }
+        new_dist = get_tour_dist(dist, tour);
+        diff = old_dist - new_dist;
+        if (j != 0) {
+            assert(diff >= 0);
+            if (diff == 0) {
+                break;
+            }
+        }
+        old_dist = new_dist;
+    }
+
+    assert(is_tour(tour));
+    return new_dist;
+}
+
+
+// A single run of the Lin-Kernighan algorithm with a random initial tour
+template <class Dist>
+int lin_kernighan(const Dist &dist, int n, unsigned long long seed, int run, vector<int> &tour) {
     vector<int> perm = vector<int>(n, 0);
     for (int i = 0; i < n; i++) {
         perm[i] = i;
     }
-    shuffle(perm.begin(), perm.end(), default_random_engine(seed));
-    vector<int> tour = vector<int>(n, 0);
+    philox_rng gen(seed, 0, run, STREAM_SHUFFLE);
+    rng_shuffle(perm.data(), n, gen);
+    tour.assign(n, 0);
     for (int i = 0; i < n - 1; i++) {
         tour[perm[i]] = perm[i + 1];
     }
     tour[perm[n - 1]] = perm[0];
-    
-    for (int j = 0; j < 100; j++) {
+    return lk_optimize(dist, n, tour);
+}
+
+
+/*  Double-bridge kick: cuts a tour given in visiting order into A B C D at
+    three distinct random points and reconnects it as A C B D, a change no
+    single Lin-Kernighan move undoes. Needs at least 8 cities */
+void double_bridge(const vector<int> &order, philox_rng &gen, vector<int> &kicked) {
+    int n = order.size();
+    int cut[3];
+    do {
+        for (int i = 0; i < 3; i++) {
+            cut[i] = 1 + gen.below(n - 1);
+        }
+        sort(cut, cut + 3);
+    } while (cut[0] == cut[1] || cut[1] == cut[2]);
+    kicked.clear();
+    kicked.insert(kicked.end(), order.begin(), order.begin() + cut[0]);
+    kicked.insert(kicked.end(), order.begin() + cut[1], order.begin() + cut[2]);
+    kicked.insert(kicked.end(), order.begin() + cut[0], order.begin() + cut[1]);
+    kicked.insert(kicked.end(), order.begin() + cut[2], order.end());
+}
+
+
+/*  Runs lk_optimize on a tour given in visiting order, in place, then up to
+    'kicks' times applies a double-bridge kick to the best tour so far and
+    optimizes it again, keeping the result if it is shorter. No kick starts
+    after 'deadline' (a wall_time(), 0 for none) */
+struct lk_polish {
+    vector<int> &order;
+    int kicks;
+    unsigned long long seed;
+    double deadline;
+    double cost;
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        int n = order.size();
+        vector<int> tour(n), kicked;
         for (int i = 0; i < n; i++) {
-            lk_move(i, tour);
+            tour[order[i]] = order[(i + 1) % n];
         }
-        new_dist = get_tour_dist(tour);
-        diff = old_dist - new_dist;
-        if (j != 0) {
-            assert(diff >= 0);
-            if (diff == 0) {
+        cost = lk_optimize(dist, n, tour);
+        for (int i = 0, c = 0; i < n; i++, c = tour[c]) {
+            order[i] = c;
+        }
+        for (int k = 0; k < kicks && n >= 8; k++) {
+            if (deadline > 0 && wall_time() > deadline) {
                 break;
             }
+            philox_rng gen(seed, 0, k, STREAM_KICK);
+            double_bridge(order, gen, kicked);
+            for (int i = 0; i < n; i++) {
+                tour[kicked[i]] = kicked[(i + 1) % n];
+            }
+            double kicked_cost = lk_optimize(dist, n, tour);
+            if (kicked_cost < cost) {
+                cost = kicked_cost;
+                for (int i = 0, c = 0; i < n; i++, c = tour[c]) {
+                    order[i] = c;
+                }
+            }
+        }
+    }
+};
+
+
+/*  Runs Lin-Kernighan 'runs' times in parallel and keeps the lowest cost tour
+    Ties go to the lowest run, so the tour does not depend on the thread count.
+    With a monitor every tour is offered to it, and the runs not yet started
+    are skipped once it reaches its target gap */
+struct lk_runs {
+    int n;
+    int runs;
+    unsigned long long seed;
+    double deadline;                // wall_time() after which no restart starts, 0 for none
+    bound_monitor *monitor;
+    double opt_cost;
+    vector<int> opt_tour;
+    int done_runs;
+
+    lk_runs(int n, int runs, unsigned long long seed, double deadline, bound_monitor *monitor)
+        : n(n), runs(runs), seed(seed), deadline(deadline), monitor(monitor), opt_cost(DBL_MAX),
+          done_runs(0) {}
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        int threads = omp_get_max_threads();
+        vector<double> best_cost(threads, DBL_MAX);
+        vector<int> best_run(threads, -1);
+        vector<vector<int> > best_tour(threads);
+        int count = 0;
+        #pragma omp parallel for schedule(static) reduction(+:count)
+        for (int i = 0; i < runs; i++) {
+            // the first restart always runs, so there is a tour
+            if (i > 0 && ((monitor && monitor->reached()) || (deadline > 0 && wall_time() > deadline))) {
+                continue;
+            }
+            vector<int> tour;
+            double cost = lin_kernighan(dist, n, seed, i, tour);
+            count++;
+            if (monitor) {
+                monitor->offer_upper(cost);
+            }
+            int t = omp_get_thread_num();
+            if (cost < best_cost[t]) {
+                best_cost[t] = cost;
+                best_run[t] = i;
+                best_tour[t].swap(tour);
+            }
+        }
+
+        int best = -1;
+        for (int t = 0; t < threads; t++) {
+            if (best_run[t] >= 0 && (best < 0 || best_cost[t] < best_cost[best] ||
+                                     (best_cost[t] == best_cost[best] && best_run[t] < best_run[best]))) {
+                best = t;
+            }
+        }
+        done_runs = count;
+        opt_cost = best_cost[best];
+        // Successor array to visiting order
+        opt_tour.resize(n);
+        for (int i = 0, c = 0; i < n; i++, c = best_tour[best][c]) {
+            opt_tour[i] = c;
         }
-        old_dist = new_dist;
     }
+};
+
+
+double improve(const dist_data &inst, vector<int> &order, int kicks, unsigned long long seed,
+               double deadline) {
+    lk_polish polish = {order, kicks, seed, deadline, 0};
+    dispatch_metric(inst, polish);
+    return polish.cost;
+}
+
+
+/*  Inserts every city missing from a tour given in visiting order between the
+    two consecutive cities where it adds the least length, and returns the
+    inserted cities */
+template <class Dist>
+vector<int> cheapest_insertion(const Dist &dist, int n, vector<int> &order) {
+    vector<char> in_tour(n, 0);
+    for (size_t i = 0; i < order.size(); i++) {
+        in_tour[order[i]] = 1;
+    }
+    vector<int> added;
+    for (int c = 0; c < n; c++) {
+        if (in_tour[c]) {
+            continue;
+        }
+        added.push_back(c);
+        if (order.size() < 2) {
+            order.push_back(c);
+            continue;
+        }
+        int m = order.size();
+        int best = 0;
+        double best_delta = DBL_MAX;
+        for (int i = 0; i < m; i++) {
+            int a = order[i], b = order[(i + 1) % m];
+            double delta = (double)dist(a, c) + dist(c, b) - dist(a, b);
+            if (delta < best_delta) {
+                best_delta = delta;
+                best = i;
+            }
+        }
+        order.insert(order.begin() + best + 1, c);
+    }
+    return added;
+}
+
+
+/*  Repairs a tour after a small change and re-optimizes it locally
+    Missing cities are inserted first. Lin-Kernighan moves then start only from
+    a worklist seeded with the inserted cities, their tour neighbours and the
+    given dirty cities. Whenever a move shortens the tour, every city whose
+    tour neighbours it changed joins the worklist, so the search spreads just
+    as far as the improvements do instead of passing over the whole tour */
+struct lk_local {
+    vector<int> &order;
+    const vector<int> &dirty;
+    int n;
+    double cost;
+    int moves;
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        vector<int> seeds = cheapest_insertion(dist, n, order);
+        if (n < 4) {
+            normalize_tour(order);
+            cost = tour_length_order(dist, order.data(), n);
+            return;
+        }
+        vector<int> tour(n), pred(n);
+        for (int i = 0; i < n; i++) {
+            tour[order[i]] = order[(i + 1) % n];
+            pred[order[(i + 1) % n]] = order[i];
+        }
+        int added = seeds.size();
+        for (int i = 0; i < added; i++) {
+            seeds.push_back(tour[seeds[i]]);
+            seeds.push_back(pred[seeds[i]]);
+        }
+        seeds.insert(seeds.end(), dirty.begin(), dirty.end());
+
+        vector<int> queue;
+        vector<char> queued(n, 0);
+        for (size_t i = 0; i < seeds.size(); i++) {
+            if (seeds[i] >= 0 && seeds[i] < n && !queued[seeds[i]]) {
+                queued[seeds[i]] = 1;
+                queue.push_back(seeds[i]);
+            }
+        }
+        vector<int> touched;
+        for (size_t head = 0; head < queue.size(); head++) {
+            PERF_REGION("lk_local_move");
+            int c = queue[head];
+            queued[c] = 0;
+            touched.clear();
+            if (!lk_move(dist, c, tour, &touched)) {
+                continue;
+            }
+            moves++;
+            for (size_t i = 0; i < touched.size(); i++) {
+                if (!queued[touched[i]]) {
+                    queued[touched[i]] = 1;
+                    queue.push_back(touched[i]);
+                }
+            }
+        }
+
+        for (int i = 0, c = 0; i < n; i++, c = tour[c]) {
+            order[i] = c;
+        }
+        cost = get_tour_dist(dist, tour);
+    }
+};
+
+
+double reoptimize(const dist_data &inst, vector<int> &order, const vector<int> &dirty, int *moves) {
+    lk_local local = {order, dirty, inst.n, 0, 0};
+    dispatch_metric(inst, local);
+    if (moves) {
+        *moves = local.moves;
+    }
+    return local.cost;
+}
+
+
+// Enough restarts to keep every thread busy, fewer for larger instances
+int default_runs(int n, int max_threads) {
+    return ceil(1721 * pow(n, -0.74) / (double)max_threads) * (double)max_threads;
+}
+
+
+/*  Returns the lowest cost tour found over the restarts on a parsed instance,
+    starting no restart after opts.time_limit */
+tsp_result solve(const dist_data &inst, const tsp_options &opts, phase_timer *timer) {
+    int runs = opts.runs > 0 ? opts.runs : default_runs(inst.n, omp_get_max_threads());
+    double deadline = opts.time_limit > 0 ? wall_time() + opts.time_limit : 0;
+    lk_runs solver(inst.n, runs, opts.seed, deadline, opts.monitor);
+    dispatch_metric(inst, solver);
+    mark_phase(timer, PHASE_SOLVE);
+
+    tsp_result result;
+    result.cost = solver.opt_cost;
+    result.tour.swap(solver.opt_tour);
+    result.stats.push_back(tsp_stat("runs", solver.done_runs));
+    return result;
+}
 
-    assert(is_tour(tour));
-    return new_dist;
 }
- 
+
+
+#ifndef TSP_LIBRARY
+/*  Applies a delta file to a coordinate instance and the visiting order of
+    its old tour. Each line is "add X Y" or "remove ID", with TSPLIB 1-based
+    ids of the old instance. Surviving cities keep their relative numbering
+    and added ones follow them; order keeps the survivors and dirty gets the
+    cities that lost a tour neighbour. Returns false on a malformed delta */
+static bool apply_delta(string path, dist_data &inst, vector<int> &order, vector<int> &dirty) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) {
+        cout << "Could not open delta " << path << endl;
+        return false;
+    }
+    int n = inst.n;
+    vector<char> removed(n, 0);
+    vector<float> add_x, add_y;
+    char line[256], op[16];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        float x, y;
+        int id;
+        if (sscanf(line, "%15s", op) != 1 || op[0] == '#') {
+            continue;
+        }
+        if (strcmp(op, "add") == 0 && sscanf(line, "%*s %f %f", &x, &y) == 2) {
+            add_x.push_back(inst.metric == METRIC_GEO ? geo_radians(x) : x);
+            add_y.push_back(inst.metric == METRIC_GEO ? geo_radians(y) : y);
+        } else if (strcmp(op, "remove") == 0 && sscanf(line, "%*s %d", &id) == 1 && id >= 1 && id <= n) {
+            removed[id - 1] = 1;
+        } else {
+            cout << "Invalid delta line: " << line;
+            ok = false;
+        }
+    }
+    fclose(f);
+    if (!ok) {
+        return false;
+    }
+
+    dist_data next;
+    next.metric = inst.metric;
+    vector<int> index(n, -1);
+    for (int i = 0; i < n; i++) {
+        if (!removed[i]) {
+            index[i] = next.X.size();
+            next.X.push_back(inst.x[i]);
+            next.Y.push_back(inst.y[i]);
+        }
+    }
+    next.X.insert(next.X.end(), add_x.begin(), add_x.end());
+    next.Y.insert(next.Y.end(), add_y.begin(), add_y.end());
+    next.n = next.X.size();
+    if (next.n == 0) {
+        cout << "The delta removes every city" << endl;
+        return false;
+    }
+
+    // The closest survivors on either side of a removed run lose a neighbour
+    vector<int> kept;
+    for (int i = 0; i < n; i++) {
+        int c = order[i];
+        if (removed[c]) {
+            for (int d = -1; d <= 1; d += 2) {
+                int j = i;
+                do {
+                    j = (j + d + n) % n;
+                } while (j != i && removed[order[j]]);
+                if (!removed[order[j]]) {
+                    dirty.push_back(index[order[j]]);
+                }
+            }
+        } else {
+            kept.push_back(index[c]);
+        }
+    }
+    order.swap(kept);
+    next.sync_views();
+    inst = move(next);
+    inst.sync_views();
+    precompute_dist_table(inst);
+    return true;
+}
 
 
 int main(int argc, char *argv[]) {
     string file_name = "";
-    int runs = 0;
+    string warm_file = "";
+    string delta_file = "";
+    string out_file = "";
+    string save_file = "";
+    tsp_options opts;
     int max_threads = omp_get_max_threads();
     int num_threads = max_threads;
     for (int i = 0; i < argc; i++) {
@@ -214,9 +577,19 @@ int main(int argc, char *argv[]) {
         if (arg == "-f" && i + 1 < argc) {
             file_name = argv[i + 1];
         } else if (arg == "-r" && i + 1 < argc) {
-            runs = atoi(argv[i + 1]);
+            opts.runs = atoi(argv[i + 1]);
         } else if (arg == "-t" && i + 1 < argc) {
             num_threads = atoi(argv[i + 1]);
+        } else if (arg == "-seed" && i + 1 < argc) {
+            opts.seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (arg == "-warm" && i + 1 < argc) {
+            warm_file = argv[i + 1];
+        } else if (arg == "-delta" && i + 1 < argc) {
+            delta_file = argv[i + 1];
+        } else if (arg == "-o" && i + 1 < argc) {
+            out_file = argv[i + 1];
+        } else if (arg == "-save" && i + 1 < argc) {
+            save_file = argv[i + 1];
         }
     }
 
@@ -225,37 +598,63 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    is_matrix = (file_name.find(".mat") != string::npos);
-    if (is_matrix) {
-        n = parse_matrix(file_name, G);
-    } else {
-        n = parse_euc_2d(file_name, X, Y);
-    }
+    dist_data inst;
+    parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
 
-    if (runs == 0) {
-        runs = ceil(1721 * pow(n, -0.74) / (double)max_threads) * (double)max_threads;
+    if (opts.runs == 0) {
+        opts.runs = lin_kern::default_runs(inst.n, max_threads);
     }
 
     omp_set_num_threads(num_threads);
     cout << "Running with " << num_threads << " threads" << endl;
-    cout << runs << " runs" << endl;
-
-    // Run Lin-Kernighan 'runs' times and output the lowest cost
-    float cost;
-    float opt_cost = FLT_MAX;
-    #pragma omp parallel 
-    {
-        int thread_num = omp_get_thread_num();
-        #pragma omp for schedule(static) reduction(min:opt_cost)
-        for (int i = 0; i < runs; i++) {
-            cost = lin_kernighan(i);
-            if (cost < opt_cost) {
-                opt_cost = cost;
+
+    vector<int> tour;
+    double cost;
+    if (warm_file != "") {
+        // Warm start from a tour of the instance, after applying the delta if any
+        vector<char> seen(inst.n, 0);
+        bool valid = read_tour(warm_file, tour) == inst.n;
+        for (size_t i = 0; valid && i < tour.size(); i++) {
+            valid = tour[i] >= 0 && tour[i] < inst.n && !seen[tour[i]];
+            if (valid) {
+                seen[tour[i]] = 1;
+            }
+        }
+        if (!valid) {
+            cout << "Invalid tour " << warm_file << " for " << inst.n << " cities" << endl;
+            return 1;
+        }
+        vector<int> dirty;
+        if (delta_file != "") {
+            if (!inst.x) {
+                cout << "A delta needs an instance with coordinates" << endl;
+                return 1;
+            }
+            if (!apply_delta(delta_file, inst, tour, dirty)) {
+                return 1;
+            }
+            cout << inst.n << " cities after the delta" << endl;
+            if (save_file != "" && !write_binary_instance(save_file, inst)) {
+                cout << "Could not write instance " << save_file << endl;
             }
         }
+        int moves = 0;
+        cost = lin_kern::reoptimize(inst, tour, dirty, &moves);
+        cout << moves << " improving moves" << endl;
+    } else {
+        cout << opts.runs << " runs" << endl;
+        tsp_result result = lin_kern::solve(inst, opts);
+        cost = result.cost;
+        tour.swap(result.tour);
     }
-    
+
+    if (out_file != "" && !write_tour(out_file, file_name, tour)) {
+        cout << "Could not write tour " << out_file << endl;
+    }
+
     // Output optimal cost
-    cout << "Tour cost = " << opt_cost << endl;
+    cout << "Tour cost = " << setprecision(12) << cost << endl;
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,46 +1,50 @@
+/*  Converts n points into a full Euclidean distance matrix
+    Input (stdin): n followed by the x and y coordinates of n points.
+    Output (stdout): n followed by the n x n distance matrix.
+    Coordinates are read in one pass and rows are computed with a
+    vectorized loop and written as they are produced.
+*/
 #include <iostream>
+#include <vector>
+#include <string>
 #include <stdlib.h>
 #include <math.h>
+#include "parser.h"
+#include "matrix_writer.h"
 using namespace std;
 
 
 int main() {
-    // n = number of points
-    int n;
-    cin >> n;
-
-    float X[n];
-    float Y[n];
-
-    // Read in coordinates of n points
-    for (int i = 0; i < n; i++) {
-        cin >> X[i];
-        cin >> Y[i];
-    }
-
-    // Allocate weights matrix
-    float G[n][n];
+    string input = read_all(stdin);
+    const char *begin = input.data();
+    const char *end = begin + input.size();
 
+    // n = number of points
+    float nf = 0;
+    parse_numbers(begin, end, &nf, 1);
+    int n = (int)nf;
+
+    // Read in coordinates of n points, after n itself
+    vector<float> xy(1 + (size_t)2 * n);
+    parse_numbers(begin, end, xy.data(), xy.size());
+    vector<float> X(n), Y(n);
     for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            if (i == j) {
-                // A point is distance 0 away from itself
-                G[i][j] = 0;
-            } else {
-                // Compute Euclidean distance between points i and j
-                G[i][j] = sqrt(pow(X[j] - X[i], 2) + pow(Y[j] - Y[i], 2));
-            }
-        }
+        X[i] = xy[1 + 2 * i];
+        Y[i] = xy[2 + 2 * i];
     }
+    const float *x = X.data();
+    const float *y = Y.data();
 
-    // Output n and distance matrix
-    cout << n << endl;
-    for (int i = 0; i < n; i++) {
+    // Compute Euclidean distance between point i and every point
+    write_matrix(stdout, n, [=](int i, float *w) {
+        float xi = x[i], yi = y[i];
+        #pragma omp simd
         for (int j = 0; j < n; j++) {
-            cout << G[i][j] << " ";
+            float dx = x[j] - xi;
+            float dy = y[j] - yi;
+            w[j] = sqrtf(dx * dx + dy * dy);
         }
-        cout << endl;
-    }
+    });
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,228 @@
+/*  Generates synthetic instances of any size for scaling benchmarks
+    Usage: ./gen_instance -n N [-t TYPE] [-s SEED] [-o OUT_FILE] [-c CLUSTERS] [-r RANGE] [-b]
+      -t TYPE      uniform, clustered or grid for EUC_2D instances, matrix for
+                   a random metric distance matrix (default uniform)
+      -c CLUSTERS  number of cluster centers for clustered (default n / 100)
+      -r RANGE     coordinates lie in [0, RANGE) (default 1000000)
+      -b           write the binary instance format instead of text
+    Every node draws from its own counter-based stream, so nodes are generated
+    in parallel and the output depends only on the type, size and seed.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "parser.h"
+#include "matrix_writer.h"
+#include "../common/rng.h"
+
+using namespace std;
+
+// Nodes formatted per parallel step when writing text
+#define GEN_BLOCK_NODES 65536
+
+
+// Returns a standard normal sample using the Box-Muller transform
+double normal(philox_rng &rng) {
+    double u1 = 1.0 - rng.uniform();
+    double u2 = rng.uniform();
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+// Places n points uniformly at random in the square [0, range)
+void gen_uniform(int n, unsigned long long seed, double range, vector<float> &X, vector<float> &Y) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        philox_rng rng(seed, 0, i, STREAM_INIT);
+        X[i] = floor(rng.uniform() * range);
+        Y[i] = floor(rng.uniform() * range);
+    }
+}
+
+
+/*  Places n points in Gaussian clusters around uniformly placed centers
+    The spread of each cluster shrinks with the number of clusters, as in the
+    DIMACS clustered instances */
+void gen_clustered(int n, unsigned long long seed, double range, int clusters,
+                   vector<float> &X, vector<float> &Y) {
+    vector<float> cx(clusters), cy(clusters);
+    gen_uniform(clusters, seed ^ 0x5bd1e995ULL, range, cx, cy);
+    double sigma = range / sqrt((double)clusters) / 4.0;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        philox_rng rng(seed, 0, i, STREAM_INIT);
+        int c = rng.below(clusters);
+        double x = cx[c] + normal(rng) * sigma;
+        double y = cy[c] + normal(rng) * sigma;
+        X[i] = floor(min(max(x, 0.0), range - 1));
+        Y[i] = floor(min(max(y, 0.0), range - 1));
+    }
+}
+
+
+// Places n points on a square grid, each moved by up to a third of the spacing
+void gen_grid(int n, unsigned long long seed, double range, vector<float> &X, vector<float> &Y) {
+    int side = (int)ceil(sqrt((double)n));
+    double spacing = range / side;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        philox_rng rng(seed, 0, i, STREAM_INIT);
+        double x = (i % side + 0.5) * spacing + (rng.uniform() - 0.5) * spacing / 1.5;
+        double y = (i / side + 0.5) * spacing + (rng.uniform() - 0.5) * spacing / 1.5;
+        X[i] = floor(x);
+        Y[i] = floor(y);
+    }
+}
+
+
+/*  Returns the weight of edge {i, j} of a random metric matrix
+    Weights lie in [range / 2, range], so any two edges are at least as long as
+    a third one and the triangle inequality always holds */
+float matrix_weight(unsigned long long seed, int i, int j, double range) {
+    if (i == j) {
+        return 0;
+    }
+    philox_rng rng(seed, min(i, j), max(i, j), STREAM_INIT);
+    return floor(range / 2 + rng.uniform() * (range / 2 + 1));
+}
+
+
+// Writes coordinates as a TSPLIB EUC_2D file, formatting blocks of nodes in parallel
+void write_tsplib(FILE *out, string name, string comment, int n, vector<float> &X, vector<float> &Y) {
+    fprintf(out, "NAME : %s\nCOMMENT : %s\nTYPE : TSP\nDIMENSION : %d\n", name.c_str(), comment.c_str(), n);
+    fprintf(out, "EDGE_WEIGHT_TYPE : EUC_2D\nNODE_COORD_SECTION\n");
+    int blocks = (n + GEN_BLOCK_NODES - 1) / GEN_BLOCK_NODES;
+    vector<string> text(blocks);
+    #pragma omp parallel for schedule(dynamic, 1) ordered
+    for (int b = 0; b < blocks; b++) {
+        string &s = text[b];
+        char num[32];
+        int end = min(n, (b + 1) * GEN_BLOCK_NODES);
+        for (int i = b * GEN_BLOCK_NODES; i < end; i++) {
+            s.append(num, to_chars(num, num + sizeof(num), i + 1).ptr);
+            s.push_back(' ');
+            s.append(num, to_chars(num, num + sizeof(num), (long long)X[i]).ptr);
+            s.push_back(' ');
+            s.append(num, to_chars(num, num + sizeof(num), (long long)Y[i]).ptr);
+            s.push_back('\n');
+        }
+        #pragma omp ordered
+        {
+            fwrite(s.data(), 1, s.size(), out);
+            string().swap(s);
+        }
+    }
+    fprintf(out, "EOF\n");
+}
+
+
+int main(int argc, char *argv[]) {
+    int n = 0;
+    string type = "uniform";
+    unsigned long long seed = 0;
+    string out_name = "";
+    int clusters = 0;
+    double range = 1000000;
+    bool binary = false;
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-n" && i + 1 < argc) {
+            n = atoi(argv[i + 1]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            type = argv[i + 1];
+        } else if (arg == "-s" && i + 1 < argc) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (arg == "-o" && i + 1 < argc) {
+            out_name = argv[i + 1];
+        } else if (arg == "-c" && i + 1 < argc) {
+            clusters = atoi(argv[i + 1]);
+        } else if (arg == "-r" && i + 1 < argc) {
+            range = atof(argv[i + 1]);
+        } else if (arg == "-b") {
+            binary = true;
+        }
+    }
+
+    if (n < 2) {
+        cout << "Please specify the number of nodes by adding -n [N]" << endl;
+        return 0;
+    }
+    if (type != "uniform" && type != "clustered" && type != "grid" && type != "matrix") {
+        cout << "Unknown instance type " << type << ", use uniform, clustered, grid or matrix" << endl;
+        return 0;
+    }
+    if (clusters <= 0) {
+        clusters = max(1, n / 100);
+    }
+
+    string name = type + to_string(n) + "_" + to_string(seed);
+    if (out_name == "") {
+        out_name = name + (binary ? ".tspb" : type == "matrix" ? ".mat" : ".tsp");
+    }
+    FILE *out = binary ? NULL : fopen(out_name.c_str(), "w");
+    if (!binary && !out) {
+        cout << "Could not write " << out_name << endl;
+        return 1;
+    }
+
+    if (type == "matrix") {
+        if (binary) {
+            dist_data data;
+            data.metric = METRIC_MATRIX;
+            data.n = n;
+            data.W.resize((size_t)n * n);
+            #pragma omp parallel for schedule(dynamic, 16)
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    data.W[(size_t)i * n + j] = matrix_weight(seed, i, j, range);
+                }
+            }
+            data.sync_views();
+            if (!write_binary_instance(out_name, data)) {
+                cout << "Could not write " << out_name << endl;
+                return 1;
+            }
+        } else {
+            write_matrix(out, n, [=](int i, float *w) {
+                for (int j = 0; j < n; j++) {
+                    w[j] = matrix_weight(seed, i, j, range);
+                }
+            });
+        }
+    } else {
+        vector<float> X(n), Y(n);
+        if (type == "uniform") {
+            gen_uniform(n, seed, range, X, Y);
+        } else if (type == "clustered") {
+            gen_clustered(n, seed, range, clusters, X, Y);
+        } else {
+            gen_grid(n, seed, range, X, Y);
+        }
+        if (binary) {
+            dist_data data;
+            data.metric = METRIC_EUC_2D;
+            data.n = n;
+            data.X.swap(X);
+            data.Y.swap(Y);
+            data.sync_views();
+            if (!write_binary_instance(out_name, data)) {
+                cout << "Could not write " << out_name << endl;
+                return 1;
+            }
+        } else {
+            string comment = "Synthetic " + type + " instance, seed " + to_string(seed);
+            write_tsplib(out, name, comment, n, X, Y);
+        }
+    }
+
+    if (out && fclose(out) != 0) {
+        cout << "Could not write " << out_name << endl;
+        return 1;
+    }
+    cout << "Wrote " << n << " nodes to " << out_name << endl;
+    return 0;
+}
@@ -1,37 +1,43 @@
+/*  Converts a lower triangular matrix (with diagonal) into a full matrix
+    Input (stdin): n followed by the rows of the lower triangle.
+    Output (stdout): n followed by the n x n symmetric matrix.
+    The triangle is kept packed on the heap and rows are mirrored and
+    written as they are produced.
+*/
 #include <iostream>
+#include <vector>
+#include <string>
 #include <stdlib.h>
+#include "parser.h"
+#include "matrix_writer.h"
 using namespace std;
 
 
 int main() {
-    // n = number of nodes
-    int n;
-    cin >> n;
+    string input = read_all(stdin);
+    const char *begin = input.data();
+    const char *end = begin + input.size();
 
-    float X[n];
-    float Y[n];
+    // n = number of nodes
+    float nf = 0;
+    parse_numbers(begin, end, &nf, 1);
+    int n = (int)nf;
 
-    // Allocate weights matrix
-    float G[n][n];
+    // Read in lower triangular matrix after n, row i starts at i * (i + 1) / 2
+    vector<float> L(1 + (size_t)n * (n + 1) / 2);
+    parse_numbers(begin, end, L.data(), L.size());
+    const float *l = L.data() + 1;
 
-    // Read in lower triangular matrix
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < i + 1; j++) {
-            cin >> G[i][j];
-            if (i != j) {
-                G[j][i] = G[i][j];
-            }
+    // Row i is row i of the triangle followed by column i below the diagonal
+    write_matrix(stdout, n, [=](int i, float *w) {
+        const float *row = l + (size_t)i * (i + 1) / 2;
+        for (int j = 0; j <= i; j++) {
+            w[j] = row[j];
         }
-    }
-
-    // Output n and distance matrix
-    cout << n << endl;
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            cout << G[i][j] << " ";
+        for (int j = i + 1; j < n; j++) {
+            w[j] = l[(size_t)j * (j + 1) / 2 + i];
         }
-        cout << endl;
-    }
+    });
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,60 @@
+/*  Streaming output of n x n distance matrices in the .mat text format
+    Rows are produced and formatted in parallel a block at a time, so memory
+    stays at one block of rows no matter how large n is.
+*/
+#ifndef MATRIX_WRITER_H
+#define MATRIX_WRITER_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <charconv>
+
+// Rows formatted per parallel step
+#define WRITER_BLOCK_ROWS 64
+
+
+/*  Writes n and then every row of the matrix to out, one row per line
+    row(i, w) must fill w[0..n) with the weights of row i */
+template <class RowFn>
+void write_matrix(FILE *out, int n, RowFn row) {
+    fprintf(out, "%d\n", n);
+    std::vector<std::string> text(WRITER_BLOCK_ROWS);
+    for (int start = 0; start < n; start += WRITER_BLOCK_ROWS) {
+        int rows = std::min(WRITER_BLOCK_ROWS, n - start);
+        #pragma omp parallel
+        {
+            std::vector<float> w(n);
+            char num[32];
+            #pragma omp for schedule(dynamic, 1)
+            for (int r = 0; r < rows; r++) {
+                row(start + r, w.data());
+                std::string &line = text[r];
+                line.clear();
+                for (int j = 0; j < n; j++) {
+                    char *e = std::to_chars(num, num + sizeof(num), w[j]).ptr;
+                    line.append(num, e);
+                    line.push_back(' ');
+                }
+                line.push_back('\n');
+            }
+        }
+        for (int r = 0; r < rows; r++) {
+            fwrite(text[r].data(), 1, text[r].size(), out);
+        }
+    }
+}
+
+
+// Reads all of in into a string
+inline std::string read_all(FILE *in) {
+    std::string s;
+    char buf[1 << 16];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), in)) > 0) {
+        s.append(buf, got);
+    }
+    return s;
+}
+
+#endif
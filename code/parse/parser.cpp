@@ -1,77 +1,739 @@
 #include "parser.h"
 #include <assert.h>
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
+#include <charconv>
+#include <memory>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
-
-#define GetCurrentDir getcwd
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
-std::string get_current_dir() {
-   char buff[FILENAME_MAX]; //create string buffer to hold path
-   GetCurrentDir( buff, FILENAME_MAX );
-   string current_working_dir(buff);
-   return current_working_dir;
+// Files larger than this are tokenized by all threads
+#define PARALLEL_PARSE_BYTES (1 << 20)
+
+/*  Binary instance layout: a 64 byte header followed by 64 byte aligned
+    sections. Coordinates are stored as X[n] then Y[n] (radians for GEO),
+    weights as the table pack_matrix makes of them, in the layout the header
+    names, so they are mapped straight into the oracle; only asymmetric
+    matrices with fractional weights, which it keeps no table for, are
+    stored as a row-major n x n float matrix. Candidates are n x k ints.
+    A section is absent when its offset is 0. Version 1 files, which had no
+    table, are still read */
+#define BINARY_MAGIC "TSPBIN\0\0"
+#define BINARY_VERSION 2
+
+struct binary_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t metric;
+    uint32_t n;
+    uint32_t k;
+    uint64_t coord_offset;
+    uint64_t weight_offset;
+    uint64_t cand_offset;
+    uint64_t table_offset;
+    uint32_t table;           // table_layout of the table section
+    uint8_t reserved[4];
+};
+
+
+// Read-only memory mapping of a whole file, unmapped when it goes out of scope
+struct mapped_file {
+    const char *data;
+    size_t size;
+    bool valid;
+
+    /*  Maps the regular file at path, exiting if that fails unless quiet is
+        set, which only leaves valid false */
+    mapped_file(string path, bool quiet = false) : data(NULL), size(0), valid(false) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (quiet) {
+                return;
+            }
+            cerr << "Could not open instance " << path << endl;
+            exit(1);
+        }
+        size = st.st_size;
+        if (size > 0) {
+            void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                size = 0;
+                if (quiet) {
+                    return;
+                }
+                cerr << "Could not map instance " << path << endl;
+                exit(1);
+            }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data = (const char *)p;
+        }
+        close(fd);
+        valid = true;
+    }
+
+    ~mapped_file() {
+        if (data) {
+            munmap((void *)data, size);
+        }
+    }
+};
+
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
 }
 
-// Parses distance matrix of file_name into G and returns number of nodes n
-int parse_matrix(string file_name, vector<vector<float> > &G) {
-    ifstream instance;
-    string str;
-    int n;
 
-    if ((get_current_dir()).find("code") != string::npos) {
-        instance.open("../../instances/matrix/" + file_name, ios::in);
-    } else{
-        // for benchmarking to be able to parse files too
-        instance.open("instances/matrix/" + file_name, ios::in);
+// Returns the start of the next token at or after p
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p)) {
+        p++;
     }
-    instance >> n;
-    for (int i = 0; i < n; i++) {
-        G.push_back(vector<float>(n, 0));
-        for (int j = 0; j < n; j++) {
-            instance >> G[i][j];
+    return p;
+}
+
+
+// Returns the end of the token starting at p
+static const char *skip_token(const char *p, const char *end) {
+    while (p < end && !is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+
+/*  Parses the number at p into x and returns the position after its token,
+    or NULL with x = 0 if the token is not a number */
+static const char *parse_float(const char *p, const char *end, float &x) {
+    if (p < end && *p == '+') {
+        p++;
+    }
+    from_chars_result res = from_chars(p, end, x);
+    if (res.ec != errc()) {
+        x = 0;
+        return NULL;
+    }
+    return skip_token(res.ptr, end);
+}
+
+
+// Returns the first position >= p that starts a token or whitespace run
+static const char *align_to_token(const char *begin, const char *p, const char *end) {
+    while (p > begin && p < end && !is_space(p[-1])) {
+        p++;
+    }
+    return p;
+}
+
+
+/*  Parses count whitespace separated numbers from [begin, end) into out and
+    returns how many of them were read before the text ended or a token was
+    not a number; the rest of out is left as it was
+    Large inputs are split into byte ranges, one per thread: each thread counts
+    the tokens starting in its range, a prefix sum gives each range its first
+    output index, and then every range is parsed independently */
+size_t parse_numbers(const char *begin, const char *end, float *out, size_t count) {
+    int chunks = 1;
+#ifdef _OPENMP
+    if ((size_t)(end - begin) >= PARALLEL_PARSE_BYTES) {
+        chunks = omp_get_max_threads();
+    }
+#endif
+    if (chunks == 1) {
+        const char *p = begin;
+        size_t i = 0;
+        for (; i < count; i++) {
+            p = skip_space(p, end);
+            if (p == end || !(p = parse_float(p, end, out[i]))) {
+                break;
+            }
+        }
+        return i;
+    }
+
+    vector<const char *> bounds(chunks + 1);
+    for (int c = 0; c <= chunks; c++) {
+        bounds[c] = align_to_token(begin, begin + (end - begin) / chunks * c, end);
+    }
+    bounds[chunks] = end;
+    vector<size_t> first(chunks + 1, 0);
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < chunks; c++) {
+        size_t tokens = 0;
+        const char *p = skip_space(bounds[c], bounds[c + 1]);
+        while (p < bounds[c + 1]) {
+            tokens++;
+            p = skip_space(skip_token(p, end), bounds[c + 1]);
+        }
+        first[c + 1] = tokens;
+    }
+    for (int c = 0; c < chunks; c++) {
+        first[c + 1] += first[c];
+    }
+
+    // parsed[c] is where range c stopped, short of first[c + 1] at a bad token
+    vector<size_t> parsed(chunks);
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < chunks; c++) {
+        const char *p = bounds[c];
+        size_t i = first[c];
+        for (; i < first[c + 1] && i < count; i++) {
+            if (!(p = parse_float(skip_space(p, end), end, out[i]))) {
+                break;
+            }
+        }
+        parsed[c] = i;
+    }
+    for (int c = 0; c < chunks; c++) {
+        if (parsed[c] < min(first[c + 1], count)) {
+            return parsed[c];
+        }
+    }
+    return min(first[chunks], count);
+}
+
+
+static bool has_suffix(const string &s, const string &suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+/*  Resolves an instance name to a path
+    file_name is used as is if it exists, otherwise it is looked up in the
+    instances directory relative to the repository root or a solver directory */
+string instance_path(string file_name) {
+    if (access(file_name.c_str(), R_OK) == 0) {
+        return file_name;
+    }
+    const char *roots[] = {"instances/", "../../instances/"};
+    const char *dirs[] = {"matrix/", "euc2d/"};
+    for (int i = 0; i < 2; i++) {
+        for (int d = 0; d < 2; d++) {
+            string path = roots[i] + string(dirs[d]) + file_name;
+            if (access(path.c_str(), R_OK) == 0) {
+                return path;
+            }
         }
     }
+    return file_name;
+}
+
+
+// Returns the path of the binary cache of a text instance, e.g. st70.tsp -> st70.tspb
+string binary_path(string path) {
+    if (has_suffix(path, ".tspb")) {
+        return path;
+    }
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        return path + ".tspb";
+    }
+    return path.substr(0, dot) + ".tspb";
+}
+
+
+// Parses the distance matrix text in [begin, end) into row-major G and returns number of nodes n
+static int parse_matrix_text(const char *begin, const char *end, vector<float> &G) {
+    const char *p = skip_space(begin, end);
+    float nf;
+    p = parse_float(p, end, nf);
+    // every weight takes at least one byte, so larger sizes cannot be right
+    if (!p || !(nf >= 1 && (double)nf * nf <= end - p)) {
+        G.clear();
+        return 0;
+    }
+    int n = (int)nf;
+    G.resize((size_t)n * n);
+    if (parse_numbers(p, end, G.data(), G.size()) < G.size()) {
+        G.clear();
+        return 0;
+    }
     return n;
 }
 
 
-// Parses coordinates of file_name into X and Y and returns number of nodes n
-int parse_euc_2d(string file_name, vector<float> &X, vector<float> &Y) {
-    ifstream instance;
-    string str;
+// Parses distance matrix at path into row-major G and returns number of nodes n
+int parse_matrix(string path, vector<float> &G) {
+    mapped_file file(path);
+    int n = parse_matrix_text(file.data, file.data + file.size, G);
+    if (n == 0) {
+        cerr << "Could not parse instance " << path << endl;
+        exit(1);
+    }
+    return n;
+}
+
+
+// Maps a TSPLIB EDGE_WEIGHT_TYPE to its metric, defaulting to EUC_2D
+metric_type metric_from_name(string name) {
+    if (name == "CEIL_2D") {
+        return METRIC_CEIL_2D;
+    } else if (name == "ATT") {
+        return METRIC_ATT;
+    } else if (name == "GEO") {
+        return METRIC_GEO;
+    }
+    return METRIC_EUC_2D;
+}
+
+
+// Converts a TSPLIB DDD.MM coordinate to radians as in the TSPLIB specification
+float geo_radians(float x) {
+    const double PI = 3.141592;
+    int deg = (int)x;
+    double min = x - deg;
+    return PI * (deg + 5.0 * min / 3.0) / 180.0;
+}
+
+
+// TSPLIB specification entries used by the parser
+struct tsplib_header {
     int n;
-    float xi, yi;
+    string weight_type;
+    string weight_format;
+    string section;
+};
 
-    if ((get_current_dir()).find("code") != string::npos) {
-        instance.open("../../instances/euc2d/" + file_name, ios::in);
-    } else{
-        // for benchmarking to be able to parse files too
-        instance.open("instances/euc2d/" + file_name, ios::in);
+
+static string trim(string s) {
+    s.erase(s.find_last_not_of(" \t\r") + 1);
+    s.erase(0, s.find_first_not_of(" \t"));
+    return s;
+}
+
+
+/*  Reads the specification part of a TSPLIB file into h and returns the
+    position right after the first NODE_COORD_SECTION or EDGE_WEIGHT_SECTION
+    Entries are written either as "KEY: VALUE" or "KEY : VALUE" */
+static const char *read_header(const char *p, const char *end, tsplib_header &h) {
+    h.n = 0;
+    h.weight_type = "EUC_2D";
+    h.weight_format = "FULL_MATRIX";
+    while (p < end) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        if (!eol) {
+            eol = end;
+        }
+        string line(p, eol);
+        p = eol + (eol < end);
+        size_t colon = line.find(':');
+        string key = trim(line.substr(0, colon));
+        if (key == "NODE_COORD_SECTION" || key == "EDGE_WEIGHT_SECTION") {
+            h.section = key;
+            break;
+        }
+        if (colon == string::npos) {
+            continue;
+        }
+        string value = trim(line.substr(colon + 1));
+        if (key == "DIMENSION") {
+            h.n = atoi(value.c_str());
+        } else if (key == "EDGE_WEIGHT_TYPE") {
+            h.weight_type = value;
+        } else if (key == "EDGE_WEIGHT_FORMAT") {
+            h.weight_format = value;
+        }
     }
-    instance >> str;
-    while (instance.good() && str != "DIMENSION" && str != "DIMENSION:") {
-        instance >> str;
+    return p;
+}
+
+
+/*  Parses n node lines "id x y" from p into X and Y, returning false if
+    there are fewer */
+static bool parse_coords(const char *p, const char *end, int n, vector<float> &X, vector<float> &Y) {
+    vector<float> nodes((size_t)3 * n);
+    if (parse_numbers(p, end, nodes.data(), nodes.size()) < nodes.size()) {
+        return false;
     }
-    if (str == "DIMENSION") {
-        instance >> str;
+    X.resize(n);
+    Y.resize(n);
+    for (int i = 0; i < n; i++) {
+        X[i] = nodes[3 * i + 1];
+        Y[i] = nodes[3 * i + 2];
     }
-    instance >> n;
-    while (str != "NODE_COORD_SECTION") {
-        instance >> str;
+    return true;
+}
+
+
+/*  Returns the number of weights stored for an EXPLICIT EDGE_WEIGHT_FORMAT
+    and sets diag to whether the diagonal is included and upper to whether
+    row i lists the weights to j >= i. A column-wise format lists the same
+    numbers as the row-wise format of the opposite triangle */
+static size_t explicit_layout(string format, int n, bool &diag, bool &upper) {
+    size_t m = n;
+    diag = format.find("DIAG") != string::npos;
+    upper = (format.find("UPPER") == 0) == (format.find("_ROW") != string::npos);
+    return diag ? m * (m + 1) / 2 : m * (m - 1) / 2;
+}
+
+
+/*  Expands the weights of an EXPLICIT section in format into the row-major
+    n x n matrix W, returning false for an unknown format or missing weights */
+static bool parse_explicit(const char *p, const char *end, int n, string format, vector<float> &W) {
+    W.assign((size_t)n * n, 0);
+    if (format == "FULL_MATRIX") {
+        return parse_numbers(p, end, W.data(), W.size()) == W.size();
+    }
+    if (format.find("_ROW") == string::npos && format.find("_COL") == string::npos) {
+        return false;
+    }
+    bool diag, upper;
+    vector<float> packed(explicit_layout(format, n, diag, upper));
+    if (parse_numbers(p, end, packed.data(), packed.size()) < packed.size()) {
+        return false;
     }
+
+    // Every unordered pair {i, j} is written by exactly one row i
+    #pragma omp parallel for schedule(dynamic, 64)
     for (int i = 0; i < n; i++) {
-        instance >> str;
-        instance >> xi;
-        instance >> yi;
-        X.push_back(xi);
-        Y.push_back(yi);
-    }
-    assert(X.size() == n);
-    assert(Y.size() == n);
-    return n;
+        size_t row, first, last;
+        if (upper) {
+            first = diag ? i : i + 1;
+            last = n;
+            row = (size_t)i * n - (size_t)i * (i - 1) / 2 - (diag ? 0 : i);
+        } else {
+            first = 0;
+            last = diag ? i + 1 : i;
+            row = diag ? (size_t)i * (i + 1) / 2 : (size_t)i * (i - 1) / 2;
+        }
+        for (size_t j = first; j < last; j++) {
+            float w = packed[row + j - first];
+            W[(size_t)i * n + j] = w;
+            W[j * n + i] = w;
+        }
+    }
+    return true;
+}
+
+
+/*  Parses coordinates at path into X and Y and returns number of nodes n
+    If metric is given it receives the EDGE_WEIGHT_TYPE of the instance */
+int parse_euc_2d(string path, vector<float> &X, vector<float> &Y, metric_type *metric) {
+    mapped_file file(path);
+    const char *end = file.data + file.size;
+    tsplib_header h;
+    const char *p = read_header(file.data, end, h);
+    if (!parse_coords(p, end, h.n, X, Y)) {
+        cerr << "Could not parse instance " << path << endl;
+        exit(1);
+    }
+    if (metric) {
+        *metric = metric_from_name(h.weight_type);
+    }
+    return h.n;
+}
+
+
+/*  Parses TSPLIB text in [begin, end) into data, either as coordinates or, for
+    EXPLICIT instances, as the full matrix expanded from its EDGE_WEIGHT_FORMAT
+    Returns number of nodes n, or -1 if the dimension does not fit the text,
+    there are fewer nodes or weights than it says or the EDGE_WEIGHT_FORMAT is
+    unsupported */
+static int parse_tsplib_text(const char *begin, const char *end, dist_data &data) {
+    tsplib_header h;
+    const char *p = read_header(begin, end, h);
+    if (h.n <= 0 || (size_t)h.n > (size_t)(end - p)) {
+        return -1;
+    }
+    data.n = h.n;
+    if (h.weight_type == "EXPLICIT") {
+        data.metric = METRIC_MATRIX;
+        if (h.section != "EDGE_WEIGHT_SECTION" || !parse_explicit(p, end, h.n, h.weight_format, data.W)) {
+            return -1;
+        }
+        return data.n;
+    }
+    data.metric = metric_from_name(h.weight_type);
+    if (!parse_coords(p, end, h.n, data.X, data.Y)) {
+        return -1;
+    }
+    if (data.metric == METRIC_GEO) {
+        for (int i = 0; i < data.n; i++) {
+            data.X[i] = geo_radians(data.X[i]);
+            data.Y[i] = geo_radians(data.Y[i]);
+        }
+    }
+    return data.n;
+}
+
+
+static int parse_tsplib(string path, dist_data &data) {
+    mapped_file file(path);
+    if (parse_tsplib_text(file.data, file.data + file.size, data) < 0) {
+        cerr << "Could not parse instance " << path << endl;
+        exit(1);
+    }
+    return data.n;
+}
+
+
+// True if a section of bytes at offset lies after the header and within a file of size bytes
+static bool section_fits(uint64_t offset, uint64_t bytes, size_t size) {
+    return offset >= sizeof(binary_header) && offset <= size && bytes <= size - offset;
+}
+
+
+/*  Maps the binary instance at path into data without copying and returns
+    number of nodes n, or -1 if path is not a valid binary instance: one
+    with another magic or version, no nodes, an unknown metric, no section
+    the distances can be computed from, or a section past the end of it */
+int load_binary_instance(string path, dist_data &data) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(binary_header)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    data.mapping = shared_ptr<const void>(p, [size](const void *m) { munmap((void *)m, size); });
+
+    const char *base = (const char *)p;
+    const binary_header *h = (const binary_header *)base;
+    uint64_t n = h->n;
+    uint64_t table_offset = h->version == 1 ? 0 : h->table_offset;
+    // matrices need weights or their table, the other metrics coordinates
+    bool distances = h->metric == METRIC_MATRIX ? h->weight_offset || table_offset : h->coord_offset;
+    if (memcmp(h->magic, BINARY_MAGIC, 8) != 0 || (h->version != 1 && h->version != BINARY_VERSION) ||
+        n == 0 || n > INT32_MAX || h->metric > METRIC_GEO || !distances ||
+        (table_offset && (h->table == TABLE_NONE || h->table > TABLE_PACKED_F32 ||
+                          !section_fits(table_offset, table_bytes((table_layout)h->table, n), size))) ||
+        (h->coord_offset && !section_fits(h->coord_offset, 2 * n * sizeof(float), size)) ||
+        (h->weight_offset && !section_fits(h->weight_offset, n * n * sizeof(float), size)) ||
+        (h->cand_offset && (h->k == 0 || h->k > n || !section_fits(h->cand_offset, n * h->k * sizeof(int), size)))) {
+        data.mapping.reset();
+        return -1;
+    }
+    data.metric = (metric_type)h->metric;
+    data.n = h->n;
+    if (h->coord_offset) {
+        data.x = (const float *)(base + h->coord_offset);
+        data.y = data.x + n;
+    }
+    if (h->weight_offset) {
+        data.w = (const float *)(base + h->weight_offset);
+    }
+    if (h->cand_offset) {
+        data.cand = (const int *)(base + h->cand_offset);
+        data.k = h->k;
+    }
+    if (table_offset) {
+        data.q = base + table_offset;
+        data.table = (table_layout)h->table;
+    }
+    return data.n;
+}
+
+
+// Writes bytes from p at the next 64 byte aligned offset and returns that offset
+static uint64_t write_section(FILE *f, const void *p, size_t bytes) {
+    static const char zeros[64] = {0};
+    long pos = ftell(f);
+    long aligned = (pos + 63) & ~63L;
+    fwrite(zeros, 1, aligned - pos, f);
+    fwrite(p, 1, bytes, f);
+    return aligned;
+}
+
+
+/*  Writes every section of data that is set to path in the binary instance
+    format. The file is written under a temporary name in the same directory
+    and renamed over path, since processes that mapped the old file (tspd's
+    cache) would fault if it were truncated under them */
+bool write_binary_instance(string path, const dist_data &data) {
+    string temp = path + ".XXXXXX";
+    int fd = mkstemp(&temp[0]);
+    if (fd < 0) {
+        return false;
+    }
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(temp.c_str());
+        return false;
+    }
+    size_t n = data.n;
+    binary_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BINARY_MAGIC, 8);
+    h.version = BINARY_VERSION;
+    h.metric = data.metric;
+    h.n = data.n;
+    fwrite(&h, sizeof(h), 1, f);
+
+    if (data.x) {
+        h.coord_offset = write_section(f, data.x, n * sizeof(float));
+        fwrite(data.y, sizeof(float), n, f);
+    }
+    // weights go in as their table, computed here unless data has one already
+    dist_data packed;
+    if (data.w && data.table == TABLE_NONE) {
+        packed.n = data.n;
+        packed.w = data.w;
+        pack_matrix(packed);
+    }
+    const dist_data &table = packed.table != TABLE_NONE ? packed : data;
+    if ((data.w || data.metric == METRIC_MATRIX) && table.table != TABLE_NONE) {
+        h.table = table.table;
+        h.table_offset = write_section(f, table.q, table_bytes(table.table, data.n));
+    } else if (data.w) {
+        h.weight_offset = write_section(f, data.w, n * n * sizeof(float));
+    }
+    if (data.cand) {
+        h.k = data.k;
+        h.cand_offset = write_section(f, data.cand, n * data.k * sizeof(int));
+    }
+    fseek(f, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, f);
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    // mkstemp creates the file readable by its owner only
+    ok = ok && chmod(temp.c_str(), 0644) == 0 && rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        unlink(temp.c_str());
+    }
+    return ok;
+}
+
+
+// Returns true if path exists and was modified no earlier than source
+static bool is_fresh(string path, string source) {
+    struct stat st, src;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    return stat(source.c_str(), &src) != 0 || st.st_mtime >= src.st_mtime;
+}
+
+
+/*  Parses the text instance at path into data and returns number of nodes n
+    .mat files hold a full matrix, anything else is a TSPLIB file */
+int parse_text_instance(string path, dist_data &data) {
+    if (path.find(".mat") != string::npos) {
+        data.metric = METRIC_MATRIX;
+        data.n = parse_matrix(path, data.W);
+    } else {
+        parse_tsplib(path, data);
+    }
+    data.sync_views();
+    return data.n;
+}
+
+
+/*  Parses an instance held in memory into data and returns number of nodes n,
+    or -1 if it cannot be read; matrix selects the .mat format over TSPLIB */
+int parse_instance_text(const char *begin, const char *end, bool matrix, dist_data &data) {
+    if (matrix) {
+        data.metric = METRIC_MATRIX;
+        data.n = parse_matrix_text(begin, end, data.W);
+    } else if (parse_tsplib_text(begin, end, data) < 0) {
+        return -1;
+    }
+    if (data.n <= 0) {
+        return -1;
+    }
+    data.sync_views();
+    return data.n;
+}
+
+
+/*  Loads the instance at path into data and returns number of nodes n
+    .tspb files and up to date binary caches next to a text instance are
+    mapped directly, anything else is parsed as text */
+int parse_instance(string path, dist_data &data) {
+    string cache = binary_path(path);
+    if (is_fresh(cache, path) && load_binary_instance(cache, data) >= 0) {
+        return data.n;
+    }
+    if (has_suffix(path, ".tspb")) {
+        cerr << "Invalid binary instance " << path << endl;
+        exit(1);
+    }
+    return parse_text_instance(path, data);
+}
+
+
+/*  Loads the instance at path like parse_instance, but returns -1 instead of
+    exiting when it is missing or malformed, for long running callers */
+int try_parse_instance(string path, dist_data &data) {
+    string cache = binary_path(path);
+    if (is_fresh(cache, path) && load_binary_instance(cache, data) >= 0) {
+        return data.n;
+    }
+    if (has_suffix(path, ".tspb")) {
+        return -1;
+    }
+    mapped_file file(path, true);
+    if (!file.valid || file.size == 0) {
+        return -1;
+    }
+    return parse_instance_text(file.data, file.data + file.size, path.find(".mat") != string::npos, data);
+}
+
+
+/*  Reads the TOUR_SECTION of a TSPLIB tour file into order, as 0-based cities
+    in visiting order, and returns the number of cities or -1 if there is none */
+int read_tour(string path, vector<int> &order) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) {
+        return -1;
+    }
+    order.clear();
+    char token[256];
+    bool section = false;
+    while (fscanf(f, "%255s", token) == 1) {
+        if (!section) {
+            section = strcmp(token, "TOUR_SECTION") == 0;
+            continue;
+        }
+        int id = atoi(token);
+        if (id <= 0) {
+            break;
+        }
+        order.push_back(id - 1);
+    }
+    fclose(f);
+    return section ? (int)order.size() : -1;
+}
+
+
+// Writes a tour given as 0-based cities in visiting order as a TSPLIB tour file
+bool write_tour(string path, string name, const vector<int> &order) {
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "NAME : %s\nTYPE : TOUR\nDIMENSION : %zu\nTOUR_SECTION\n", name.c_str(), order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        fprintf(f, "%d\n", order[i] + 1);
+    }
+    fprintf(f, "-1\nEOF\n");
+    return fclose(f) == 0;
 }
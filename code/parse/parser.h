@@ -1,7 +1,25 @@
+#ifndef PARSER_H
+#define PARSER_H
+
 #include <string>
 #include <vector>
+#include "../common/dist.h"
 
 
-int parse_matrix(std::string file_name, std::vector<std::vector<float> > &G);
-int parse_euc_2d(std::string file_name, std::vector<float> &X, std::vector<float> &Y);
+std::string instance_path(std::string file_name);
+size_t parse_numbers(const char *begin, const char *end, float *out, size_t count);
+int parse_matrix(std::string path, std::vector<float> &G);
+int parse_euc_2d(std::string path, std::vector<float> &X, std::vector<float> &Y,
+                 metric_type *metric = NULL);
+int parse_text_instance(std::string path, dist_data &data);
+int parse_instance_text(const char *begin, const char *end, bool matrix, dist_data &data);
+int parse_instance(std::string path, dist_data &data);
+int try_parse_instance(std::string path, dist_data &data);
+std::string binary_path(std::string path);
+int load_binary_instance(std::string path, dist_data &data);
+bool write_binary_instance(std::string path, const dist_data &data);
+float geo_radians(float x);
+int read_tour(std::string path, std::vector<int> &order);
+bool write_tour(std::string path, std::string name, const std::vector<int> &order);
 
+#endif
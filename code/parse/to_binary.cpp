@@ -0,0 +1,65 @@
+/*  Converts a .tsp or .mat instance into the binary instance format
+    The solvers map the binary file directly instead of parsing text, and pick
+    it up automatically when it sits next to the text instance.
+    Usage: ./to_binary -f FILE_NAME [-o OUT_FILE] [-k K] [-w]
+      -k K  also store the K nearest neighbours of every node
+      -w    also store the full weight matrix of a coordinate instance
+*/
+#include <iostream>
+#include <stdlib.h>
+#include "parser.h"
+
+using namespace std;
+
+
+int main(int argc, char *argv[]) {
+    string file_name = "";
+    string out_name = "";
+    int k = 0;
+    bool with_weights = false;
+    for (int i = 0; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            file_name = argv[i + 1];
+        } else if (arg == "-o" && i + 1 < argc) {
+            out_name = argv[i + 1];
+        } else if (arg == "-k" && i + 1 < argc) {
+            k = atoi(argv[i + 1]);
+        } else if (arg == "-w") {
+            with_weights = true;
+        }
+    }
+
+    if (file_name == "") {
+        cout << "Please specify a filename by adding -f [FILE_NAME]" << endl;
+        return 0;
+    }
+
+    string path = instance_path(file_name);
+    if (out_name == "") {
+        out_name = binary_path(path);
+    }
+    if (out_name == path) {
+        cout << "Input is already a binary instance" << endl;
+        return 0;
+    }
+
+    // Always parse the text so a stale cache is never converted
+    dist_data data;
+    parse_text_instance(path, data);
+    int n = data.n;
+
+    if (with_weights && !data.w) {
+        expand_dist_matrix(data);
+    }
+    if (k > 0) {
+        compute_candidates(data, k);
+    }
+
+    if (!write_binary_instance(out_name, data)) {
+        cout << "Could not write " << out_name << endl;
+        return 1;
+    }
+    cout << "Wrote " << n << " nodes to " << out_name << endl;
+    return 0;
+}
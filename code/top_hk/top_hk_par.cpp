@@ -7,26 +7,13 @@
 using namespace std;
 
 // Global variables
-bool is_matrix;
 int n;
-vector<vector<float> > G;
-vector<float> X, Y;
+dist_data inst;
 int **memo;
 
-// Returns the distance from node i to node j
-float dist(int i, int j) {
-    if (is_matrix) {
-        return G[i][j];
-    } else {
-        int dx = X[i] - X[j];
-        int dy = Y[i] - Y[j];
-        // Round to be consistent with official TSPLIB solutions
-        return (int)(sqrt(dx * dx + dy * dy) + 0.5);
-    }
-}
-
 // Subset dp to solve for shortest non simple TSP path
-int dp(int S, int v) {
+template <class Dist>
+int dp(const Dist &dist, int S, int v) {
     // We've already solved this subproblem
     if (memo[S][v] != -1) {
         return memo[S][v];
@@ -45,7 +32,7 @@ int dp(int S, int v) {
     #pragma omp parallel for
     for (int u = 0; u < n; u++) {
         if (u != v && (S >> u & 1 == 1)) {
-            val = dp(S & ~(1 << (v)), u) + dist(u, v);
+            val = dp(dist, S & ~(1 << (v)), u) + dist(u, v);
             if (first || minval >= val) {
                 minval = val;
                 minprev = u;
@@ -60,6 +47,19 @@ int dp(int S, int v) {
     return minval;
 }
 
+// Solves the full tour starting and ending at node 0
+struct top_hk_run {
+    unsigned S;
+    int cost;
+
+    top_hk_run(unsigned S) : S(S), cost(0) {}
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        cost = dp(dist, S, 0);
+    }
+};
+
 int main(int argc, char *argv[]) {
     int num_threads = omp_get_max_threads();
 
@@ -80,12 +80,8 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    is_matrix = (file_name.find(".mat") != string::npos);
-    if (is_matrix) {
-        n = parse_matrix(file_name, G);
-    } else {
-        n = parse_euc_2d(file_name, X, Y);
-    }
+    n = parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
 
     if (n > 30) {
         cout << "Please run on a smaller graph with at most 30 vertices" << endl;
@@ -107,7 +103,9 @@ int main(int argc, char *argv[]) {
         memset(memo[i], -1, n * sizeof(int));
     }
 
-    cout << "Tour cost = " << dp(S, 0) << endl;
+    top_hk_run solver(S);
+    dispatch_metric(inst, solver);
+    cout << "Tour cost = " << solver.cost << endl;
 
     return 0;
 }
\ No newline at end of file
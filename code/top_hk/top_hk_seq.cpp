@@ -6,25 +6,12 @@
 using namespace std;
 
 // Global variables
-bool is_matrix;
 int n;
-vector<vector<float> > G;
-vector<float> X, Y;
-
-// Returns the distance from node i to node j
-float dist(int i, int j) {
-    if (is_matrix) {
-        return G[i][j];
-    } else {
-        int dx = X[i] - X[j];
-        int dy = Y[i] - Y[j];
-        // Round to be consistent with official TSPLIB solutions
-        return (int)(sqrt(dx * dx + dy * dy) + 0.5);
-    }
-}
+dist_data inst;
 
 // Subset dp to solve for shortest non simple TSP path
-int dp(int S, int v, int **memo) {
+template <class Dist>
+int dp(const Dist &dist, int S, int v, int **memo) {
     // We've already solved this subproblem
     if (memo[S][v] != -1) {
         return memo[S][v];
@@ -42,7 +29,7 @@ int dp(int S, int v, int **memo) {
     int c = 0;
     for (int u = 0; u < n; u++) {
         if (u != v && (S >> u & 1 == 1)) {
-            val = dp(S & ~(1 << (v)), u, memo) + dist(u, v);
+            val = dp(dist, S & ~(1 << (v)), u, memo) + dist(u, v);
             if (first || minval >= val) {
                 minval = val;
                 minprev = u;
@@ -57,6 +44,20 @@ int dp(int S, int v, int **memo) {
     return minval;
 }
 
+// Solves the full tour starting and ending at node 0
+struct top_hk_run {
+    unsigned S;
+    int **memo;
+    int cost;
+
+    top_hk_run(unsigned S, int **memo) : S(S), memo(memo), cost(0) {}
+
+    template <class Dist>
+    void operator()(const Dist &dist) {
+        cost = dp(dist, S, 0, memo);
+    }
+};
+
 int main(int argc, char *argv[]) {
     string file_name = "";
     for (int i = 0; i < argc; i++) {
@@ -71,12 +72,8 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    is_matrix = (file_name.find(".mat") != string::npos);
-    if (is_matrix) {
-        n = parse_matrix(file_name, G);
-    } else {
-        n = parse_euc_2d(file_name, X, Y);
-    }
+    n = parse_instance(instance_path(file_name), inst);
+    precompute_dist_table(inst);
 
     if (n > 30) {
         cout << "Please run on a smaller graph with at most 30 vertices" << endl;
@@ -95,7 +92,9 @@ int main(int argc, char *argv[]) {
         memset(memo[i], -1, n * sizeof(int));
     }
 
-    cout << "Tour cost = " << dp(S, 0, memo) << endl;
+    top_hk_run solver(S, memo);
+    dispatch_metric(inst, solver);
+    cout << "Tour cost = " << solver.cost << endl;
 
     return 0;
 }
\ No newline at end of file
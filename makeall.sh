@@ -1,6 +1,8 @@
 #!/usr/bin/env bash
 
-cd code/held_karp
+cd code/parse
+make
+cd ../held_karp
 make
 cd ../top_hk
 make
@@ -8,5 +10,17 @@ cd ../lin_kern
 make
 cd ../genetic
 make
+cd ../branch_bound
+make
+cd ../annealing
+make
+cd ../cluster
+make
+cd ../aco
+make
+cd ../libtsp
+make
+cd ../bench
+make
 
 cd ../..